@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <errno.h>
+
+#include <asm/dwt.h>
+#include <asm/hwio.h>
+#include <asm/machine.h>
+#include <phabos/clocksource.h>
+
+#define DEMCR               0xE000EDFC
+#define DEMCR_TRCENA        (1 << 24)
+
+#define DWT_CTRL            0xE0001000
+#define DWT_CTRL_NOCYCCNT   (1 << 25)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+static uint32_t dwt_read(struct clocksource *cs)
+{
+    return dwt_get_cycles();
+}
+
+static struct clocksource dwt_clocksource = {
+    .name = "dwt",
+    .rating = 300,
+    .freq = CPU_FREQ,
+    .mask = 0xffffffff,
+    .read = dwt_read,
+};
+
+int dwt_clocksource_init(void)
+{
+    uint32_t start;
+
+    write32(DEMCR, read32(DEMCR) | DEMCR_TRCENA);
+
+    if (read32(DWT_CTRL) & DWT_CTRL_NOCYCCNT)
+        return -ENODEV;
+
+    write32(DWT_CTRL, read32(DWT_CTRL) | DWT_CTRL_CYCCNTENA);
+
+    /* some cores and emulators accept the writes but never count */
+    start = dwt_get_cycles();
+    for (int i = 0; i < 10; i++)
+        asm volatile("nop");
+    if (dwt_get_cycles() == start)
+        return -ENODEV;
+
+    return clocksource_register(&dwt_clocksource);
+}
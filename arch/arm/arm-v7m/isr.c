@@ -137,8 +137,9 @@ static void _start(void)
 
     main();
 
+    /* idle task: sleep until the next interrupt */
     while(1)
-        asm volatile("nop");
+        asm volatile("wfi");
 }
 
 __boot__ void reset_handler(void)
@@ -11,12 +11,26 @@
 
 #include <config.h>
 #include <phabos/scheduler.h>
+#include <phabos/hrtimer.h>
+#include <phabos/clocksource.h>
+#include <phabos/softirq.h>
+#include <phabos/tick.h>
 #include <asm/scheduler.h>
 #include <asm/hwio.h>
 #include <asm/machine.h>
 
 #define ICSR                            0xE000ED04
 #define ICSR_PENDSVSET                  (1 << 28)
+#define ICSR_PENDSTSET                  (1 << 26)
+
+#define STCSR                           0xE000E010
+#define STCSR_SYSTICK_ENABLE            (1 << 0)
+#define STCSR_TICKINT                   (1 << 1)
+#define STCSR_CLKSOURCE                 (1 << 2)
+#define STRVR                           0xE000E014
+#define STCVR                           0xE000E018
+
+#define SYSTICK_RELOAD                  (CPU_FREQ / HZ - 1)
 
 #define SHPR3                           0xE000ED20
 #define SHPR3_PENDSV_PRIO_OFFSET        2
@@ -57,8 +71,47 @@ extern struct task *current;
 extern bool need_resched;
 
 uint64_t scheduler_ticks;
+struct seqcount clock_seqcount = SEQCOUNT_INIT(clock_seqcount);
 void watchdog_check_expired(void);
 
+/**
+ * Get the number of SysTick cycles elapsed since the last tick
+ *
+ * If the counter wrapped around but the SysTick handler did not run yet,
+ * ticks is incremented to account for the pending tick.
+ */
+static uint32_t systick_elapsed(uint64_t *ticks)
+{
+    uint32_t val = read32(STCVR);
+
+    if (read32(ICSR) & ICSR_PENDSTSET) {
+        val = read32(STCVR);
+        (*ticks)++;
+    }
+
+    return val ? SYSTICK_RELOAD + 1 - val : 0;
+}
+
+static uint32_t systick_read(struct clocksource *cs)
+{
+    uint64_t ticks = scheduler_ticks;
+    uint32_t cycles = systick_elapsed(&ticks);
+
+    return (uint32_t) ticks * (SYSTICK_RELOAD + 1) + cycles;
+}
+
+/*
+ * The tick count extended with the current SysTick value is a free-running
+ * counter at CPU_FREQ, always available but slow to read.
+ */
+static struct clocksource systick_clocksource = {
+    .name = "systick",
+    .rating = 100,
+    .freq = CPU_FREQ,
+    .mask = 0xffffffff,
+    .read = systick_read,
+};
+
 void scheduler_arch_init(void)
 {
     scheduler_ticks = 0;
@@ -66,14 +119,11 @@ void scheduler_arch_init(void)
     /* lower the priority of PendSV */
     write8(SHPR3 + SHPR3_PENDSV_PRIO_OFFSET, 255);
 
-#define STRVR 0xE000E014
-    write32(STRVR, CPU_FREQ / HZ);
-
-#define STCSR                0xE000E010
-#define STCSR_SYSTICK_ENABLE (1 << 0)
-#define STCSR_TICKINT        (1 << 1)
-#define STCSR_CLKSOURCE      (1 << 2)
+    write32(STRVR, SYSTICK_RELOAD);
+    write32(STCVR, 0);
     write32(STCSR, STCSR_SYSTICK_ENABLE | STCSR_TICKINT | STCSR_CLKSOURCE);
+
+    clocksource_register(&systick_clocksource);
 }
 
 void task_init_registers(struct task *task, void *task_entry, void *data,
@@ -102,34 +152,47 @@ void task_yield(void)
 
 uint32_t systick_handler(uint32_t *stack_top)
 {
+    write_seqcount_begin(&clock_seqcount);
     scheduler_ticks++;
+    timekeeping_tick();
+    write_seqcount_end(&clock_seqcount);
 
 #ifdef CONFIG_SCHEDULER_WATCHDOG
     watchdog_check_expired();
 #endif
 
+    hrtimer_run_queues();
+
     uint32_t exception = stack_top[PSR_REG] & PSR_ISR_NUM_MASK;
     if (exception == EXCEPTION_THREAD_MODE) {
-        schedule(stack_top);
+        if (schedule(stack_top))
+            return current->registers[SP_REG];
     } else {
         write32(ICSR, read32(ICSR) | ICSR_PENDSVSET);
         need_resched = true;
-        return (uint32_t) (stack_top + 1);
     }
 
-    return current->registers[SP_REG];
+    return (uint32_t) (stack_top + 1);
+}
+
+void softirq_arch_raise(void)
+{
+    write32(ICSR, read32(ICSR) | ICSR_PENDSVSET);
 }
 
 uint32_t pendsv_handler(uint32_t *stack_top)
 {
     uint32_t sp;
 
-    irq_disable();
+    softirq_run();
 
-    if (need_resched)
-        schedule(stack_top);
+    irq_disable();
 
-    sp = current->registers[SP_REG];
+    /* PendSV is also raised for the softirqs alone */
+    if (need_resched && schedule(stack_top))
+        sp = current->registers[SP_REG];
+    else
+        sp = (uint32_t) (stack_top + 1);
 
     irq_enable();
 
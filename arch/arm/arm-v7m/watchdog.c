@@ -7,41 +7,206 @@
 
 #include <string.h>
 #include <assert.h>
-#include <stdlib.h>
 
 #include <asm/spinlock.h>
 #include <asm/machine.h>
 #include <asm/scheduler.h>
 #include <phabos/list.h>
 #include <phabos/watchdog.h>
+#include <phabos/ktime.h>
+#include <phabos/tick.h>
+#include <phabos/div64.h>
+#include <phabos/softirq.h>
+#include <phabos/scheduler.h>
 
-static struct list_head wdog_head = LIST_INIT(wdog_head);
+/*
+ * Watchdogs are kept in a hierarchical timing wheel. Level 0 has one slot per
+ * tick, and each following level has slots WHEEL_SIZE times as wide. When
+ * level 0 wraps around, the next slot of level 1 is cascaded down, and so on.
+ * Arming and cancelling are O(1), and each tick only touches the slot that
+ * expires plus, once every WHEEL_SIZE ticks, the slot being cascaded.
+ *
+ * Watchdogs expiring further away than the wheel can represent are put in
+ * the last slot of the last level and re-cascaded until they fit.
+ *
+ * The tick interrupt only moves the expired watchdogs to an expiry list, the
+ * callbacks are then executed by the timer softirq or by the timer task
+ * depending on the watchdog context.
+ */
+#define WHEEL_BITS      5
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+#define TIMER_TASK_NOTIFY_EXPIRED   (1 << 0)
+
+static struct list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_ticks;
+static bool wheel_initialized;
 static struct spinlock wdog_lock = SPINLOCK_INIT(wdog_lock);
 
-struct watchdog_priv {
-    struct watchdog *wd;
-    struct list_head list;
-    uint64_t start;
-    uint64_t end;
-};
+static struct list_head softirq_expired = LIST_INIT(softirq_expired);
+static struct list_head task_expired = LIST_INIT(task_expired);
+static struct task *timer_task;
 
-#define to_watchdog_priv(x) ((struct watchdog_priv*) wd->priv)
+#ifdef CONFIG_STATIC_KERNEL
+static struct task timer_task_storage;
+static uint8_t timer_task_stack[TASK_DEFAULT_STACK_SIZE];
+#endif
+extern struct task *current;
 
-bool watchdog_has_expired(struct watchdog *wd)
+/**
+ * Must be called with wdog_lock held
+ */
+static void wheel_add(struct watchdog *wd)
 {
-    assert(wd);
-    assert(wd->priv);
+    uint64_t end = wd->end;
+    uint64_t delta;
+    int level;
+
+    if (end < wheel_ticks)
+        end = wheel_ticks;
 
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
+    delta = end - wheel_ticks;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        end = wheel_ticks + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+            break;
+    }
 
+    list_add(&wheel[level][(end >> (WHEEL_BITS * level)) & WHEEL_MASK],
+             &wd->list);
+}
+
+/**
+ * Move all the watchdogs of a slot back into the lower levels
+ *
+ * Returns the index of the slot that was cascaded
+ */
+static int wheel_cascade(int level)
+{
+    int index = (wheel_ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    list_foreach_safe(&wheel[level][index], iter) {
+        struct watchdog *wd = list_entry(iter, struct watchdog, list);
+
+        list_del(&wd->list);
+        wheel_add(wd);
+    }
+
+    return index;
+}
+
+/**
+ * Re-arm a periodic watchdog one period after its previous expiry
+ *
+ * Periods that already elapsed are skipped and counted in overruns. Must be
+ * called with wdog_lock held, before running the callback so that the
+ * callback can cancel or restart the watchdog.
+ */
+static void watchdog_forward(struct watchdog *wd)
+{
     uint64_t ticks = get_ticks();
-    if (wdog->end > wdog->start) {
-        return ticks >= wdog->end;
-    } else {
-        return ticks >= wdog->end && ticks < wdog->start;
+    uint64_t missed = 0;
+
+    if (wd->end + wd->period <= ticks)
+        missed = div_u64(ticks - wd->end, wd->period);
+
+    wd->overruns = missed;
+    wd->end += (missed + 1) * wd->period;
+
+    wheel_add(wd);
+}
+
+static void watchdog_run_expired(struct list_head *expired)
+{
+    spinlock_lock(&wdog_lock);
+
+    while (!list_is_empty(expired)) {
+        struct watchdog *wd = list_first_entry(expired, struct watchdog, list);
+
+        list_del(&wd->list);
+
+        if (wd->period)
+            watchdog_forward(wd);
+
+        spinlock_unlock(&wdog_lock);
+        wd->timeout(wd);
+        spinlock_lock(&wdog_lock);
     }
 
-    return false;
+    spinlock_unlock(&wdog_lock);
+}
+
+static void watchdog_softirq(void)
+{
+    watchdog_run_expired(&softirq_expired);
+}
+
+static void watchdog_timer_task(void *data)
+{
+    while (1) {
+        task_notify_wait(TIMER_TASK_NOTIFY_EXPIRED, 0);
+        watchdog_run_expired(&task_expired);
+    }
+}
+
+void watchdog_timer_task_init(void)
+{
+    assert(!timer_task);
+
+#ifdef CONFIG_STATIC_KERNEL
+    timer_task = task_init(&timer_task_storage, watchdog_timer_task, NULL,
+                           timer_task_stack, sizeof(timer_task_stack));
+#else
+    timer_task = task_create(watchdog_timer_task, NULL, 0);
+#endif
+    assert(timer_task);
+
+    /* expired timers must not wait behind the tasks they are waking up */
+    task_set_priority(timer_task, TASK_PRIORITY_HIGH);
+    task_start(timer_task);
+}
+
+static void wheel_init(void)
+{
+    for (int i = 0; i < WHEEL_LEVELS; i++)
+        for (int j = 0; j < WHEEL_SIZE; j++)
+            list_init(&wheel[i][j]);
+
+    softirq_register(TIMER_SOFTIRQ, watchdog_softirq);
+
+    wheel_ticks = get_ticks();
+    wheel_initialized = true;
+}
+
+/**
+ * Move the expiry time later, within the slack, to a tick with as many low
+ * bits cleared as possible. Watchdogs armed around the same time then end up
+ * expiring on the same tick instead of waking up the system one by one.
+ */
+static uint64_t watchdog_apply_slack(uint64_t end, uint64_t slack)
+{
+    uint64_t limit = end + slack;
+    uint64_t mask = end ^ limit;
+
+    if (!mask)
+        return end;
+
+    mask = (1ULL << (63 - __builtin_clzll(mask))) - 1;
+    return limit & ~mask;
+}
+
+bool watchdog_has_expired(struct watchdog *wd)
+{
+    assert(wd);
+
+    return get_ticks() >= wd->end;
 }
 
 /**
@@ -49,61 +214,110 @@ bool watchdog_has_expired(struct watchdog *wd)
  */
 void watchdog_check_expired(void)
 {
-    list_foreach_safe(&wdog_head, iter) {
-        struct watchdog_priv *wdog =
-            list_entry(iter, struct watchdog_priv, list);
-        struct watchdog *wd = wdog->wd;
+    uint64_t ticks = get_ticks();
+
+    if (!wheel_initialized)
+        return;
+
+    spinlock_lock(&wdog_lock);
+
+    while (wheel_ticks <= ticks) {
+        int index = wheel_ticks & WHEEL_MASK;
+
+        if (!index) {
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                if (wheel_cascade(level))
+                    break;
+            }
+        }
+
+        wheel_ticks++;
+
+        list_foreach_safe(&wheel[0][index], iter) {
+            struct watchdog *wd = list_entry(iter, struct watchdog, list);
+
+            list_del(iter);
+            if (wd->context == WATCHDOG_CONTEXT_TASK)
+                list_add(&task_expired, iter);
+            else
+                list_add(&softirq_expired, iter);
+        }
+    }
+
+    if (!list_is_empty(&softirq_expired))
+        softirq_raise(TIMER_SOFTIRQ);
+
+    if (!list_is_empty(&task_expired))
+        task_notify(timer_task, TIMER_TASK_NOTIFY_EXPIRED,
+                    TASK_NOTIFY_SET_BITS);
+
+    spinlock_unlock(&wdog_lock);
+}
+
+static void __watchdog_start(struct watchdog *wd, unsigned long usec,
+                             uint32_t period)
+{
+    uint64_t ticks = get_ticks();
+    unsigned long slack;
+
+    spinlock_lock(&wdog_lock);
+
+    if (!wheel_initialized)
+        wheel_init();
+
+    if (!list_is_empty(&wd->list))
+        list_del(&wd->list);
 
-        if (!watchdog_has_expired(wd))
-            continue;
+    wd->period = period;
+    wd->overruns = 0;
+    wd->end = ticks + usecs_to_ticks(usec);
 
-        watchdog_cancel(wd);
-        wd->timeout(wd); // FIXME call from a thread
+    /* periodic watchdogs keep their exact cadence */
+    if (!period) {
+        slack = wd->slack;
+        if (slack == WATCHDOG_SLACK_DEFAULT)
+            slack = current ? current->timer_slack : 0;
+
+        wd->end = watchdog_apply_slack(wd->end, slack / USEC_PER_TICK);
     }
+
+    wheel_add(wd);
+
+    spinlock_unlock(&wdog_lock);
 }
 
 void watchdog_start(struct watchdog *wd, unsigned long usec)
 {
     assert(wd);
-    assert(wd->priv);
     assert(usec > 0);
 
-    uint64_t ticks = get_ticks();
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
+    __watchdog_start(wd, usec, 0);
+}
 
-    wdog->start = ticks;
-#define ONE_SEC_IN_USEC 1000000
-    wdog->end = ticks + (usec / ONE_SEC_IN_USEC) * HZ;
-    if (wdog->end == ticks)
-        wdog->end = ticks + 1;
+void watchdog_start_periodic(struct watchdog *wd, unsigned long period)
+{
+    assert(wd);
+    assert(period > 0);
 
-    spinlock_lock(&wdog_lock);
-    list_add(&wdog_head, &wdog->list);
-    spinlock_unlock(&wdog_lock);
+    __watchdog_start(wd, period, usecs_to_ticks(period));
 }
 
 void watchdog_cancel(struct watchdog *wd)
 {
     assert(wd);
-    assert(wd->priv);
-
-    struct watchdog_priv *wdog = to_watchdog_priv(wd);
 
     spinlock_lock(&wdog_lock);
-    if (!list_is_empty(&wdog->list))
-        list_del(&wdog->list);
+    if (!list_is_empty(&wd->list))
+        list_del(&wd->list);
     spinlock_unlock(&wdog_lock);
 }
 
 void watchdog_init(struct watchdog *wd)
 {
-    struct watchdog_priv *wdog;
-
     assert(wd);
     memset(wd, 0, sizeof(*wd));
-    wd->priv = wdog = malloc(sizeof(*wdog));
-    list_init(&wdog->list);
-    wdog->wd = wd;
+    wd->slack = WATCHDOG_SLACK_DEFAULT;
+    list_init(&wd->list);
 }
 
 void watchdog_delete(struct watchdog *wd)
@@ -111,8 +325,5 @@ void watchdog_delete(struct watchdog *wd)
     if (!wd)
         return;
 
-    assert(wd->priv);
-
     watchdog_cancel(wd);
-    free(wd->priv);
 }
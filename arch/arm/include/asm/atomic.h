@@ -8,13 +8,34 @@
 #ifndef __ATOMIC_H__
 #define __ATOMIC_H__
 
+#include <config.h>
 #include <stdint.h>
+#include <asm/barrier.h>
 
 typedef int atomic_t;
+typedef int64_t atomic64_t;
+
+/*
+ * Every read-modify-write operation comes in four flavours:
+ *  - xxx_relaxed: atomic, but no ordering against other memory accesses
+ *  - xxx_acquire: later memory accesses cannot be moved before it
+ *  - xxx_release: earlier memory accesses cannot be moved after it
+ *  - xxx: fully ordered
+ *
+ * atomic_add/inc/dec and atomic_<op>_return return the new value, while
+ * atomic_fetch_<op>, atomic_xchg and atomic_cmpxchg return the old value.
+ */
 
 static inline uint32_t atomic_get(atomic_t *atomic)
 {
-    return *(uint32_t*) atomic;
+    return *(volatile uint32_t*) atomic;
+}
+
+static inline uint32_t atomic_get_acquire(atomic_t *atomic)
+{
+    uint32_t val = atomic_get(atomic);
+    dmb();
+    return val;
 }
 
 static inline void atomic_init(atomic_t *atomic, uint32_t val)
@@ -22,9 +43,281 @@ static inline void atomic_init(atomic_t *atomic, uint32_t val)
     *atomic = (atomic_t) val;
 }
 
-uint32_t atomic_add(atomic_t *atomic, int n);
-uint32_t atomic_inc(atomic_t *atomic);
-uint32_t atomic_dec(atomic_t *atomic);
+static inline void atomic_set(atomic_t *atomic, uint32_t val)
+{
+    *(volatile atomic_t*) atomic = (atomic_t) val;
+}
 
-#endif /* __ATOMIC_H__ */
+static inline void atomic_set_release(atomic_t *atomic, uint32_t val)
+{
+    dmb();
+    atomic_set(atomic, val);
+}
+
+/*
+ * Exclusive accessors, for the lock-free algorithms that need to do more
+ * between the load and the store than what the helpers below provide.
+ * store_exclusive() returns 0 on success. The exclusive monitor is cleared
+ * on exception entry and exit, so a sequence never succeeds if an
+ * interrupt touched the location in between.
+ */
+static inline uint32_t load_exclusive(volatile void *addr)
+{
+    uint32_t val;
+    asm volatile("ldrex %0, [%1]" : "=r"(val) : "r"(addr) : "memory");
+    return val;
+}
+
+static inline uint32_t store_exclusive(volatile void *addr, uint32_t val)
+{
+    uint32_t failed;
+    asm volatile("strex %0, %2, [%1]"
+                 : "=&r"(failed) : "r"(addr), "r"(val) : "memory");
+    return failed;
+}
+
+static inline void clear_exclusive(void)
+{
+    asm volatile("clrex" ::: "memory");
+}
+
+#define ATOMIC_OP_RELAXED(name, type, asm_op, result_reg)               \
+static inline uint32_t atomic_##name##_relaxed(atomic_t *atomic,        \
+                                               type val)                \
+{                                                                       \
+    uint32_t old;                                                       \
+    uint32_t new;                                                       \
+    uint32_t failed;                                                    \
+                                                                        \
+    asm volatile(                                                       \
+        "1: ldrex %0, [%4]\n"                                           \
+        "   " asm_op "\n"                                               \
+        "   strex %2, %1, [%4]\n"                                       \
+        "   teq %2, #0\n"                                               \
+        "   bne 1b\n"                                                   \
+        : "=&r"(old), "=&r"(new), "=&r"(failed), "+Qo"(*atomic)         \
+        : "r"(atomic), "r"(val)                                         \
+        : "cc");                                                        \
+                                                                        \
+    return result_reg;                                                  \
+}
+
+#define ATOMIC_OP_ORDERED(name, type)                                   \
+static inline uint32_t atomic_##name##_acquire(atomic_t *atomic,        \
+                                               type val)                \
+{                                                                       \
+    uint32_t result = atomic_##name##_relaxed(atomic, val);             \
+    dmb();                                                              \
+    return result;                                                      \
+}                                                                       \
+                                                                        \
+static inline uint32_t atomic_##name##_release(atomic_t *atomic,        \
+                                               type val)                \
+{                                                                       \
+    dmb();                                                              \
+    return atomic_##name##_relaxed(atomic, val);                        \
+}                                                                       \
+                                                                        \
+static inline uint32_t atomic_##name(atomic_t *atomic, type val)        \
+{                                                                       \
+    uint32_t result;                                                    \
+                                                                        \
+    dmb();                                                              \
+    result = atomic_##name##_relaxed(atomic, val);                      \
+    dmb();                                                              \
+    return result;                                                      \
+}
+
+#define ATOMIC_OP(name, type, asm_op, result_reg)                       \
+    ATOMIC_OP_RELAXED(name, type, asm_op, result_reg)                   \
+    ATOMIC_OP_ORDERED(name, type)
+
+ATOMIC_OP(add, int, "add %1, %0, %5", new)
+ATOMIC_OP(sub, int, "sub %1, %0, %5", new)
+ATOMIC_OP(fetch_add, int, "add %1, %0, %5", old)
+ATOMIC_OP(fetch_sub, int, "sub %1, %0, %5", old)
+ATOMIC_OP(fetch_or, uint32_t, "orr %1, %0, %5", old)
+ATOMIC_OP(fetch_and, uint32_t, "and %1, %0, %5", old)
+ATOMIC_OP(fetch_xor, uint32_t, "eor %1, %0, %5", old)
+ATOMIC_OP(xchg, uint32_t, "mov %1, %5", old)
+
+#undef ATOMIC_OP
+#undef ATOMIC_OP_ORDERED
+#undef ATOMIC_OP_RELAXED
+
+static inline uint32_t atomic_inc(atomic_t *atomic)
+{
+    return atomic_add(atomic, 1);
+}
+
+static inline uint32_t atomic_dec(atomic_t *atomic)
+{
+    return atomic_sub(atomic, 1);
+}
+
+static inline uint32_t atomic_inc_relaxed(atomic_t *atomic)
+{
+    return atomic_add_relaxed(atomic, 1);
+}
+
+static inline uint32_t atomic_dec_relaxed(atomic_t *atomic)
+{
+    return atomic_sub_relaxed(atomic, 1);
+}
+
+/**
+ * Atomically replace the value with new if it is equal to old
+ *
+ * Returns the value read, the exchange happened if it is equal to old.
+ */
+static inline uint32_t atomic_cmpxchg_relaxed(atomic_t *atomic, uint32_t old,
+                                              uint32_t new)
+{
+    uint32_t oldval;
+    uint32_t failed;
+
+    do {
+        asm volatile(
+            "ldrex %1, [%3]\n"
+            "mov %0, #0\n"
+            "teq %1, %4\n"
+            "it eq\n"
+            "strexeq %0, %5, [%3]\n"
+            : "=&r"(failed), "=&r"(oldval), "+Qo"(*atomic)
+            : "r"(atomic), "r"(old), "r"(new)
+            : "cc");
+    } while (failed);
+
+    return oldval;
+}
+
+static inline uint32_t atomic_cmpxchg_acquire(atomic_t *atomic, uint32_t old,
+                                              uint32_t new)
+{
+    uint32_t result = atomic_cmpxchg_relaxed(atomic, old, new);
+    dmb();
+    return result;
+}
 
+static inline uint32_t atomic_cmpxchg_release(atomic_t *atomic, uint32_t old,
+                                              uint32_t new)
+{
+    dmb();
+    return atomic_cmpxchg_relaxed(atomic, old, new);
+}
+
+static inline uint32_t atomic_cmpxchg(atomic_t *atomic, uint32_t old,
+                                      uint32_t new)
+{
+    uint32_t result;
+
+    dmb();
+    result = atomic_cmpxchg_relaxed(atomic, old, new);
+    dmb();
+    return result;
+}
+
+/*
+ * 64-bit atomics. ARMv7-M has no LDREXD/STREXD, so the operations are made
+ * atomic by masking interrupts around them.
+ */
+
+static inline uint32_t atomic64_irq_save(void)
+{
+    uint32_t primask;
+    asm volatile("mrs %0, primask\n"
+                 "cpsid i\n" : "=r"(primask) :: "memory");
+    return primask;
+}
+
+static inline void atomic64_irq_restore(uint32_t primask)
+{
+    asm volatile("msr primask, %0" :: "r"(primask) : "memory");
+}
+
+static inline uint64_t atomic64_get(atomic64_t *atomic)
+{
+    uint32_t flags = atomic64_irq_save();
+    uint64_t val = *(volatile atomic64_t*) atomic;
+    atomic64_irq_restore(flags);
+    return val;
+}
+
+static inline void atomic64_set(atomic64_t *atomic, uint64_t val)
+{
+    uint32_t flags = atomic64_irq_save();
+    *(volatile atomic64_t*) atomic = val;
+    atomic64_irq_restore(flags);
+}
+
+static inline uint64_t atomic64_add_relaxed(atomic64_t *atomic, int64_t n)
+{
+    uint32_t flags = atomic64_irq_save();
+    uint64_t result = *atomic += n;
+    atomic64_irq_restore(flags);
+    return result;
+}
+
+static inline uint64_t atomic64_xchg_relaxed(atomic64_t *atomic, uint64_t new)
+{
+    uint32_t flags = atomic64_irq_save();
+    uint64_t result = *atomic;
+    *atomic = new;
+    atomic64_irq_restore(flags);
+    return result;
+}
+
+static inline uint64_t atomic64_cmpxchg_relaxed(atomic64_t *atomic,
+                                                uint64_t old, uint64_t new)
+{
+    uint32_t flags = atomic64_irq_save();
+    uint64_t result = *atomic;
+    if (result == old)
+        *atomic = new;
+    atomic64_irq_restore(flags);
+    return result;
+}
+
+
+static inline uint64_t atomic64_add(atomic64_t *atomic, int64_t n)
+{
+    uint64_t result;
+
+    dmb();
+    result = atomic64_add_relaxed(atomic, n);
+    dmb();
+    return result;
+}
+
+static inline uint64_t atomic64_inc(atomic64_t *atomic)
+{
+    return atomic64_add(atomic, 1);
+}
+
+static inline uint64_t atomic64_dec(atomic64_t *atomic)
+{
+    return atomic64_add(atomic, -1);
+}
+
+static inline uint64_t atomic64_xchg(atomic64_t *atomic, uint64_t new)
+{
+    uint64_t result;
+
+    dmb();
+    result = atomic64_xchg_relaxed(atomic, new);
+    dmb();
+    return result;
+}
+
+static inline uint64_t atomic64_cmpxchg(atomic64_t *atomic, uint64_t old,
+                                        uint64_t new)
+{
+    uint64_t result;
+
+    dmb();
+    result = atomic64_cmpxchg_relaxed(atomic, old, new);
+    dmb();
+    return result;
+}
+
+#endif /* __ATOMIC_H__ */
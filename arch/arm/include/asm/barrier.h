@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __ARM_BARRIER_H__
+#define __ARM_BARRIER_H__
+
+#define compiler_barrier() asm volatile("" ::: "memory")
+
+#define isb() asm volatile("isb" ::: "memory")
+#define dsb() asm volatile("dsb" ::: "memory")
+#define dmb() asm volatile("dmb" ::: "memory")
+
+#endif /* __ARM_BARRIER_H__ */
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __ARM_DWT_H__
+#define __ARM_DWT_H__
+
+#include <stdint.h>
+#include <asm/hwio.h>
+
+#define DWT_CYCCNT 0xE0001004
+
+static inline uint32_t dwt_get_cycles(void)
+{
+    return read32(DWT_CYCCNT);
+}
+
+/**
+ * Enable the DWT cycle counter and register it as clocksource
+ *
+ * Returns -ENODEV if the core does not implement the cycle counter.
+ */
+int dwt_clocksource_init(void);
+
+#endif /* __ARM_DWT_H__ */
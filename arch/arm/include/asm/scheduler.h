@@ -9,7 +9,9 @@
 #define __ARM_SCHEDULER_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <asm/irq.h>
+#include <phabos/seqcount.h>
 
 typedef uint32_t register_t;
 struct task;
@@ -41,19 +43,33 @@ enum register_offset
     MAX_REG,
 };
 
+/*
+ * Protects scheduler_ticks and any other clock data updated from the SysTick
+ * handler.
+ */
+extern struct seqcount clock_seqcount;
+
 static inline uint64_t get_ticks(void)
 {
     uint64_t ticks;
+    unsigned seq;
     extern uint64_t scheduler_ticks;
 
-    irq_disable();
-    ticks = scheduler_ticks;
-    irq_enable();
+    do {
+        seq = read_seqcount_begin(&clock_seqcount);
+        ticks = scheduler_ticks;
+    } while (read_seqcount_retry(&clock_seqcount, seq));
 
     return ticks;
 }
 
-void schedule(uint32_t *stack_top);
+/**
+ * Save the context of the running task and switch to the next one
+ *
+ * Returns false if the scheduler is locked, in which case the context is not
+ * saved and the interrupted task must be resumed from stack_top.
+ */
+bool schedule(uint32_t *stack_top);
 void scheduler_arch_init(void);
 void task_init_registers(struct task *task, void *task_entry, void *data,
                          uint32_t stack_addr);
@@ -12,7 +12,6 @@
 #define VTOR_ALIGNMENT 256
 
 #define CPU_FREQ        50000000
-#define HZ              1000
 
 #endif /* __MACHINE_H__ */
 
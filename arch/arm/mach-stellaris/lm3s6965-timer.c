@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdint.h>
+
+#include <asm/hwio.h>
+#include <asm/irq.h>
+#include <asm/machine.h>
+#include <phabos/clockevent.h>
+#include <phabos/clocksource.h>
+
+#define SYSCTL_RCGC1            0x400fe104
+#define SYSCTL_RCGC1_TIMER0     (1 << 16)
+#define SYSCTL_RCGC1_TIMER1     (1 << 17)
+
+#define GPTM0_BASE              0x40030000
+#define GPTM1_BASE              0x40031000
+
+#define GPTMCFG(base)           ((base) + 0x0)
+#define GPTMTAMR(base)          ((base) + 0x4)
+#define GPTMCTL(base)           ((base) + 0xc)
+#define GPTMIMR(base)           ((base) + 0x18)
+#define GPTMICR(base)           ((base) + 0x24)
+#define GPTMTAILR(base)         ((base) + 0x28)
+#define GPTMTAR(base)           ((base) + 0x48)
+
+#define GPTMCFG_32BIT           0
+#define GPTMTAMR_ONESHOT        1
+#define GPTMTAMR_PERIODIC       2
+#define GPTMCTL_TAEN            (1 << 0)
+#define GPTMIMR_TATOIM          (1 << 0)
+#define GPTMICR_TATOCINT        (1 << 0)
+
+#define GPTM0A_IRQ              19
+
+static void gptm_setup(uint32_t base, uint32_t mode, uint32_t load)
+{
+    write32(GPTMCTL(base), 0);
+    write32(GPTMCFG(base), GPTMCFG_32BIT);
+    write32(GPTMTAMR(base), mode);
+    write32(GPTMTAILR(base), load);
+}
+
+/*
+ * Timer0A: clockevent
+ */
+
+static int gptm_set_next_event(struct clockevent *ce, uint32_t cycles)
+{
+    gptm_setup(GPTM0_BASE, GPTMTAMR_ONESHOT, cycles);
+    write32(GPTMCTL(GPTM0_BASE), GPTMCTL_TAEN);
+    return 0;
+}
+
+static int gptm_set_periodic(struct clockevent *ce, uint32_t cycles)
+{
+    gptm_setup(GPTM0_BASE, GPTMTAMR_PERIODIC, cycles);
+    write32(GPTMCTL(GPTM0_BASE), GPTMCTL_TAEN);
+    return 0;
+}
+
+static void gptm_shutdown(struct clockevent *ce)
+{
+    write32(GPTMCTL(GPTM0_BASE), 0);
+}
+
+static struct clockevent gptm_clockevent = {
+    .name = "gptm0",
+    .rating = 200,
+    .features = CLOCKEVENT_FEAT_ONESHOT | CLOCKEVENT_FEAT_PERIODIC,
+    .freq = CPU_FREQ,
+    .min_delta = 50,
+    .max_delta = UINT32_MAX,
+    .set_next_event = gptm_set_next_event,
+    .set_periodic = gptm_set_periodic,
+    .shutdown = gptm_shutdown,
+};
+
+static void gptm_irq(int line, void *data)
+{
+    write32(GPTMICR(GPTM0_BASE), GPTMICR_TATOCINT);
+    clockevent_handle_event(&gptm_clockevent);
+}
+
+/*
+ * Timer1A: free-running clocksource
+ */
+
+static uint32_t gptm_read(struct clocksource *cs)
+{
+    return ~read32(GPTMTAR(GPTM1_BASE));
+}
+
+static struct clocksource gptm_clocksource = {
+    .name = "gptm1",
+    .rating = 200,
+    .freq = CPU_FREQ,
+    .mask = 0xffffffff,
+    .read = gptm_read,
+};
+
+void lm3s6965_timer_init(void)
+{
+    write32(SYSCTL_RCGC1, read32(SYSCTL_RCGC1) | SYSCTL_RCGC1_TIMER0 |
+                          SYSCTL_RCGC1_TIMER1);
+
+    gptm_setup(GPTM1_BASE, GPTMTAMR_PERIODIC, UINT32_MAX);
+    write32(GPTMCTL(GPTM1_BASE), GPTMCTL_TAEN);
+    clocksource_register(&gptm_clocksource);
+
+    gptm_setup(GPTM0_BASE, GPTMTAMR_ONESHOT, UINT32_MAX);
+    write32(GPTMICR(GPTM0_BASE), GPTMICR_TATOCINT);
+    write32(GPTMIMR(GPTM0_BASE), GPTMIMR_TATOIM);
+
+    irq_attach(GPTM0A_IRQ, gptm_irq, NULL);
+    irq_enable_line(GPTM0A_IRQ);
+
+    clockevent_register(&gptm_clockevent);
+}
@@ -0,0 +1,16 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <asm/dwt.h>
+
+void lm3s6965_timer_init(void);
+
+void machine_init(void)
+{
+    lm3s6965_timer_init();
+    dwt_clocksource_init();
+}
@@ -33,9 +33,11 @@
 #define VTOR_ALIGNMENT 256
 
 #define CPU_FREQ (96 * 1024 * 1024) // 96 MHz
-#define HZ       1000
 
 #define LOOP_PER_USEC 100 /* FIXME: configure using oscilloscope */
 
+/* the SRAM is on the code bus, the BUFRAM banks are the DMA-capable memory */
+#define MACH_HEAP_FLAGS MM_FAST
+
 #endif /* __MACHINE_H__ */
 
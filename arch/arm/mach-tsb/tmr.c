@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdint.h>
+
+#include <asm/hwio.h>
+#include <asm/irq.h>
+#include <asm/machine.h>
+#include <asm/tsb-irq.h>
+#include <phabos/clockevent.h>
+#include <phabos/clocksource.h>
+
+#include "scm.h"
+#include "chip.h"
+
+/*
+ * TMR0 is kept for the hardware watchdog, TMR1 is used as clockevent and TMR2
+ * as free-running clocksource.
+ */
+#define TMR_BASE_N(n)           (TMR_BASE + 0x40 * (n))
+#define TMR_LOAD(n)             (TMR_BASE_N(n) + 0x0)
+#define TMR_CNT(n)              (TMR_BASE_N(n) + 0x4)
+#define TMR_CTRL(n)             (TMR_BASE_N(n) + 0x8)
+#define TMR_ISR(n)              (TMR_BASE_N(n) + 0xc)
+
+#define TMR_CTRL_ENABLE         (1 << 0)
+#define TMR_CTRL_AUTORELOAD     (1 << 1)
+#define TMR_CTRL_INTEN          (1 << 2)
+#define TMR_ISR_EVENT           (1 << 0)
+
+#define TMR_CLOCKEVENT          1
+#define TMR_CLOCKSOURCE         2
+
+static void tmr_start(int n, uint32_t load, uint32_t ctrl)
+{
+    write32(TMR_CTRL(n), 0);
+    write32(TMR_LOAD(n), load);
+    write32(TMR_CTRL(n), TMR_CTRL_ENABLE | ctrl);
+}
+
+static int tmr_set_next_event(struct clockevent *ce, uint32_t cycles)
+{
+    tmr_start(TMR_CLOCKEVENT, cycles, TMR_CTRL_INTEN);
+    return 0;
+}
+
+static int tmr_set_periodic(struct clockevent *ce, uint32_t cycles)
+{
+    tmr_start(TMR_CLOCKEVENT, cycles, TMR_CTRL_INTEN | TMR_CTRL_AUTORELOAD);
+    return 0;
+}
+
+static void tmr_shutdown(struct clockevent *ce)
+{
+    write32(TMR_CTRL(TMR_CLOCKEVENT), 0);
+}
+
+static struct clockevent tmr_clockevent = {
+    .name = "tmr1",
+    .rating = 200,
+    .features = CLOCKEVENT_FEAT_ONESHOT | CLOCKEVENT_FEAT_PERIODIC,
+    .freq = CPU_FREQ,
+    .min_delta = 100,
+    .max_delta = UINT32_MAX,
+    .set_next_event = tmr_set_next_event,
+    .set_periodic = tmr_set_periodic,
+    .shutdown = tmr_shutdown,
+};
+
+static void tmr_irq(int line, void *data)
+{
+    write32(TMR_ISR(TMR_CLOCKEVENT), TMR_ISR_EVENT);
+    clockevent_handle_event(&tmr_clockevent);
+}
+
+static uint32_t tmr_read(struct clocksource *cs)
+{
+    return ~read32(TMR_CNT(TMR_CLOCKSOURCE));
+}
+
+static struct clocksource tmr_clocksource = {
+    .name = "tmr2",
+    .rating = 200,
+    .freq = CPU_FREQ,
+    .mask = 0xffffffff,
+    .read = tmr_read,
+};
+
+void tsb_tmr_init(void)
+{
+    tsb_clk_enable(TSB_CLK_TMR);
+    tsb_reset(TSB_RST_TMR);
+
+    tmr_start(TMR_CLOCKSOURCE, UINT32_MAX, TMR_CTRL_AUTORELOAD);
+    clocksource_register(&tmr_clocksource);
+
+    write32(TMR_CTRL(TMR_CLOCKEVENT), 0);
+    write32(TMR_ISR(TMR_CLOCKEVENT), TMR_ISR_EVENT);
+
+    irq_attach(TSB_IRQ_TMR1, tmr_irq, NULL);
+    irq_enable_line(TSB_IRQ_TMR1);
+
+    clockevent_register(&tmr_clockevent);
+}
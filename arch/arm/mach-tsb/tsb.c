@@ -30,6 +30,9 @@
 #include "chip.h"
 
 #include <asm/hwio.h>
+#include <asm/dwt.h>
+#include <phabos/kmalloc.h>
+#include <phabos/utils.h>
 
 #define UART_RBR_THR_DLL            (UART_BASE + 0x0)
 #define UART_IER_DLH                (UART_BASE + 0x4)
@@ -67,7 +70,31 @@ void tsb_uart_init(void)
     }
 }
 
+void tsb_tmr_init(void);
+
+static void tsb_bufram_init(void)
+{
+    static const struct {
+        const char *name;
+        uintptr_t base;
+    } banks[] = {
+        { "bufram0", BUFRAM0_BASE },
+        { "bufram1", BUFRAM1_BASE },
+        { "bufram2", BUFRAM2_BASE },
+        { "bufram3", BUFRAM3_BASE },
+    };
+
+    tsb_clk_enable(TSB_CLK_BUFRAM);
+
+    for (int i = 0; i < ARRAY_SIZE(banks); i++)
+        mm_add_region(banks[i].name, (void *) banks[i].base, BUFRAM_SIZE,
+                      MM_DMA);
+}
+
 void machine_init(void)
 {
     tsb_uart_init();
+    tsb_bufram_init();
+    tsb_tmr_init();
+    dwt_clocksource_init();
 }
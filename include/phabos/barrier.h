@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __BARRIER_H__
+#define __BARRIER_H__
+
+#include <stdbool.h>
+#include <phabos/list.h>
+
+struct task_barrier {
+    struct list_head wait_list;
+    unsigned count;
+    unsigned waiting;
+    unsigned generation;
+};
+
+#define TASK_BARRIER_INIT(x, n) {                   \
+    .wait_list = LIST_INIT((x).wait_list),          \
+    .count = (n),                                   \
+}
+
+/**
+ * Initialize a barrier
+ *
+ * count: number of tasks that must reach the barrier before any of them is
+ *        released
+ */
+void task_barrier_init(struct task_barrier *barrier, unsigned count);
+
+/**
+ * Wait until count tasks reach the barrier
+ *
+ * The barrier is reset once all the tasks are released so it can be reused
+ * right away.
+ *
+ * Returns true for the last task reaching the barrier, false for the others.
+ */
+bool task_barrier_wait(struct task_barrier *barrier);
+
+#endif /* __BARRIER_H__ */
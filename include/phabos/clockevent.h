@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __CLOCKEVENT_H__
+#define __CLOCKEVENT_H__
+
+#include <stdint.h>
+#include <phabos/list.h>
+#include <phabos/ktime.h>
+
+#define CLOCKEVENT_FEAT_ONESHOT     (1 << 0)
+#define CLOCKEVENT_FEAT_PERIODIC    (1 << 1)
+
+/**
+ * Programmable hardware timer used to generate timer interrupts
+ *
+ * rating: the registered clockevent with the highest rating is used
+ * features: CLOCKEVENT_FEAT_* supported by the device
+ * freq: frequency of the timer counter in Hz
+ * min_delta: minimum number of cycles that can be programmed
+ * max_delta: maximum number of cycles that can be programmed
+ * set_next_event: arm the timer to fire once in 'cycles' cycles
+ * set_periodic: make the timer fire every 'cycles' cycles (optional)
+ * shutdown: stop the timer (optional)
+ */
+struct clockevent {
+    const char *name;
+    int rating;
+    unsigned features;
+    unsigned long freq;
+    uint32_t min_delta;
+    uint32_t max_delta;
+
+    int (*set_next_event)(struct clockevent *ce, uint32_t cycles);
+    int (*set_periodic)(struct clockevent *ce, uint32_t cycles);
+    void (*shutdown)(struct clockevent *ce);
+
+    /* Private, set by the core */
+    void (*event_handler)(struct clockevent *ce);
+    uint32_t mult;
+    uint32_t shift;
+    ktime_t max_delta_ns;
+    struct list_head list;
+};
+
+/**
+ * Register a clockevent
+ *
+ * The new device replaces the current one if it has a better rating, in
+ * which case it inherits its event handler.
+ */
+int clockevent_register(struct clockevent *ce);
+struct clockevent *clockevent_get(void);
+
+/**
+ * Arm the clockevent to fire at an absolute time
+ *
+ * If the time is too far away, the clockevent fires at the maximum delta it
+ * supports, and the handler is expected to program it again.
+ */
+int clockevent_program(struct clockevent *ce, ktime_t expires);
+
+/**
+ * Make the clockevent fire periodically
+ *
+ * Returns -ENOTSUP if the device does not support the periodic mode.
+ */
+int clockevent_set_periodic(struct clockevent *ce, ktime_t period);
+
+/**
+ * Must be called by the drivers from their interrupt handler
+ */
+static inline void clockevent_handle_event(struct clockevent *ce)
+{
+    if (ce->event_handler)
+        ce->event_handler(ce);
+}
+
+#endif /* __CLOCKEVENT_H__ */
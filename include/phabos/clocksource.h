@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __CLOCKSOURCE_H__
+#define __CLOCKSOURCE_H__
+
+#include <stdint.h>
+#include <phabos/list.h>
+#include <phabos/ktime.h>
+
+/**
+ * Free-running counter used for timekeeping
+ *
+ * rating: the registered clocksource with the highest rating is used
+ * freq: frequency of the counter in Hz
+ * mask: mask of the counter bits, the counter must wrap from mask to 0
+ * read: return the current value of the counter, counting up
+ */
+struct clocksource {
+    const char *name;
+    int rating;
+    unsigned long freq;
+    uint32_t mask;
+
+    uint32_t (*read)(struct clocksource *cs);
+
+    /* Private, set by the core */
+    uint32_t mult;
+    uint32_t shift;
+    struct list_head list;
+};
+
+int clocksource_register(struct clocksource *cs);
+struct clocksource *clocksource_get(void);
+
+/**
+ * Update the timekeeping from the clocksource
+ *
+ * Executed from the SYSTICK interrupt, inside the clock_seqcount write
+ * section. It must run often enough for the clocksource not to wrap around
+ * twice between two calls.
+ */
+void timekeeping_tick(void);
+
+/**
+ * Compute the mult/shift pair converting a frequency into another
+ *
+ * The result satisfies: to_value = (from_value * mult) >> shift, without
+ * overflowing for from_value covering up to maxsec seconds.
+ */
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t from,
+                            uint32_t to, uint32_t maxsec);
+
+static inline ktime_t clocksource_cyc2ns(uint64_t cycles, uint32_t mult,
+                                         uint32_t shift)
+{
+    return (cycles * mult) >> shift;
+}
+
+#endif /* __CLOCKSOURCE_H__ */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __COMPLETION_H__
+#define __COMPLETION_H__
+
+#include <stdbool.h>
+#include <phabos/list.h>
+
+struct completion {
+    struct list_head wait_list;
+    unsigned done;
+};
+
+#define COMPLETION_INIT(x) { .wait_list = LIST_INIT((x).wait_list), .done = 0 }
+
+void completion_init(struct completion *completion);
+
+/**
+ * Mark a completion as not done anymore so that it can be reused
+ */
+void completion_reinit(struct completion *completion);
+
+/**
+ * Wait for a completion to be signaled
+ *
+ * Each call to complete() releases exactly one waiter, complete_all()
+ * releases all current and future waiters until completion_reinit().
+ */
+void wait_for_completion(struct completion *completion);
+
+/**
+ * Wait for a completion to be signaled, or for a timeout to expire
+ *
+ * timeout: maximum time to wait in microseconds
+ *
+ * Returns 0 if the completion was signaled, -ETIMEDOUT otherwise.
+ */
+int wait_for_completion_timeout(struct completion *completion,
+                                unsigned long timeout);
+
+void complete(struct completion *completion);
+void complete_all(struct completion *completion);
+bool completion_done(struct completion *completion);
+
+#endif /* __COMPLETION_H__ */
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __DIV64_H__
+#define __DIV64_H__
+
+#include <stdint.h>
+
+/**
+ * Divide a 64-bit number by a 32-bit one
+ *
+ * The kernel is not linked against the compiler runtime, so 64-bit divisions
+ * must go through this function instead of the '/' and '%' operators.
+ *
+ * remainder: if not NULL, set to the remainder of the division
+ */
+uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+    return div_u64_rem(dividend, divisor, NULL);
+}
+
+#endif /* __DIV64_H__ */
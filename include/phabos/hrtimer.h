@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __HRTIMER_H__
+#define __HRTIMER_H__
+
+#include <stdbool.h>
+#include <phabos/list.h>
+#include <phabos/ktime.h>
+
+enum hrtimer_mode {
+    HRTIMER_MODE_ABS,
+    HRTIMER_MODE_REL,
+};
+
+/**
+ * High resolution timer
+ *
+ * The callback is executed from interrupt context as soon as the timer
+ * expires. It is backed by the machine clockevent, or by the scheduler tick
+ * when the machine does not register any.
+ *
+ * slack: the timer may expire anywhere between expires and expires + slack
+ *        (in nanoseconds), letting timers with close expiry times share a
+ *        single interrupt
+ */
+struct hrtimer {
+    void (*function)(struct hrtimer *timer);
+    void *user_priv;
+
+    ktime_t expires;
+    ktime_t slack;
+    struct list_head list;
+};
+
+#define HRTIMER_INIT(x, callback) {         \
+    .function = (callback),                 \
+    .list = LIST_INIT((x).list),            \
+}
+
+void hrtimer_init(struct hrtimer *timer);
+
+/**
+ * Start or restart a timer
+ *
+ * time: expiry time in nanoseconds, either absolute (see ktime_get()) or
+ *       relative to now depending on mode
+ */
+void hrtimer_start(struct hrtimer *timer, ktime_t time, enum hrtimer_mode mode);
+void hrtimer_cancel(struct hrtimer *timer);
+bool hrtimer_is_queued(struct hrtimer *timer);
+
+/**
+ * Executed from the SYSTICK interrupt
+ */
+void hrtimer_run_queues(void);
+
+#endif /* __HRTIMER_H__ */
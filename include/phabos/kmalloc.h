@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __KMALLOC_H__
+#define __KMALLOC_H__
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MM_ZERO     (1 << 0)
+
+/*
+ * Memory region capabilities, also used as allocation constraints. Without
+ * any of them, the memory can come from any region.
+ */
+#define MM_FAST     (1 << 1)
+#define MM_DMA      (1 << 2)
+#define MM_ANY      0
+
+#define MM_MAX_REGIONS  8
+
+/* configurations predating the option get the Kconfig default */
+#ifndef CONFIG_IDLE_STACK_SIZE
+#define CONFIG_IDLE_STACK_SIZE 2048
+#endif
+
+/* the heap stops where the idle task stack starts */
+#define KERNEL_HEAP_END \
+    ((uint32_t) &_eor - CONFIG_IDLE_STACK_SIZE)
+
+extern uint32_t _eor;
+
+/**
+ * Add a memory region to the allocator
+ *
+ * Meant to be called by machine_init() for the RAM banks not covered by the
+ * linker script. The region is tried after the main heap and the regions
+ * added before it.
+ *
+ * flags: capabilities of the memory, MM_FAST and/or MM_DMA
+ *
+ * Returns 0 on success, -ENOMEM if the region is too small or if there are
+ * too many regions.
+ */
+int mm_add_region(const char *name, void *start, size_t size, unsigned flags);
+
+/**
+ * Allocate memory from the kernel heap
+ *
+ * Allocations take a constant time and can be done from an interrupt. The
+ * memory returned is 8-byte aligned. malloc() and friends end up here too.
+ *
+ * The first region having all the capabilities asked for and enough free
+ * memory is used, starting with the main heap.
+ *
+ * flags: MM_ZERO to clear the memory, MM_FAST or MM_DMA to restrict the
+ *        regions the memory can come from
+ *
+ * Returns NULL if there is not enough memory.
+ */
+void *kmalloc(size_t size, unsigned flags);
+
+/**
+ * Same as kmalloc() with an alignment constraint
+ *
+ * alignment: power of two
+ */
+void *kmemalign(size_t alignment, size_t size, unsigned flags);
+
+/**
+ * Resize an allocation, the memory stays in the same region if possible
+ */
+void *krealloc(void *ptr, size_t size);
+void kfree(void *ptr);
+
+#endif /* __KMALLOC_H__ */
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __KTIME_H__
+#define __KTIME_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* Time in nanoseconds */
+typedef uint64_t ktime_t;
+
+#define NSEC_PER_USEC   1000UL
+#define USEC_PER_SEC    1000000UL
+#define NSEC_PER_SEC    1000000000UL
+
+/**
+ * Get the monotonic time elapsed since boot, in nanoseconds
+ */
+ktime_t ktime_get(void);
+
+/**
+ * Read the raw counter of the current clocksource
+ *
+ * This is much cheaper than ktime_get() and meant for measuring short
+ * durations: take the difference of two readings and convert it with
+ * ktime_cycles_to_ns(). The counter wraps around, the difference must not
+ * span more than a few seconds.
+ */
+uint32_t ktime_get_cycles(void);
+ktime_t ktime_cycles_to_ns(uint32_t cycles);
+
+static inline ktime_t ktime_from_usec(unsigned long usec)
+{
+    return (ktime_t) usec * NSEC_PER_USEC;
+}
+
+static inline ktime_t timespec_to_ktime(const struct timespec *ts)
+{
+    return (ktime_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/*
+ * 2^62 / NSEC_PER_SEC - 2^32, the fractional part of 2^30 / NSEC_PER_SEC
+ * scaled by 2^32
+ */
+#define KTIME_SEC_RECIPROCAL    316718722UL
+
+/**
+ * Split a time into seconds and nanoseconds without a 64-bit division
+ *
+ * The time is first counted in units of 2^30 ns, which are turned into
+ * seconds by multiplying with the reciprocal of NSEC_PER_SEC. The estimate
+ * can only fall short by a few seconds, which the remainder then corrects.
+ * Valid for times below 2^62 ns, about 146 years.
+ */
+static inline struct timespec ktime_to_timespec(ktime_t time)
+{
+    struct timespec ts;
+    uint32_t units = time >> 30;
+    uint64_t sec;
+    uint64_t nsec;
+
+    sec = units + (((uint64_t) units * KTIME_SEC_RECIPROCAL) >> 32);
+    nsec = time - sec * NSEC_PER_SEC;
+
+    while (nsec >= NSEC_PER_SEC) {
+        nsec -= NSEC_PER_SEC;
+        sec++;
+    }
+
+    ts.tv_sec = sec;
+    ts.tv_nsec = nsec;
+
+    return ts;
+}
+
+#endif /* __KTIME_H__ */
@@ -15,11 +15,20 @@ struct mutex {
     struct semaphore semaphore;
 };
 
+#define MUTEX_INIT(x) { .semaphore = SEMAPHORE_INIT((x).semaphore, 1) }
+
+#ifndef CONFIG_STATIC_KERNEL
 static inline struct mutex *mutex_create(void)
 {
     return (struct mutex*) semaphore_create(1);
 }
 
+static inline void mutex_destroy(struct mutex *mutex)
+{
+    semaphore_destroy((struct semaphore*) mutex);
+}
+#endif
+
 static inline void mutex_init(struct mutex *mutex)
 {
     semaphore_init((struct semaphore*) mutex, 1);
@@ -35,11 +44,6 @@ static inline void mutex_unlock(struct mutex *mutex)
     semaphore_unlock((struct semaphore*) mutex);
 }
 
-static inline void mutex_destroy(struct mutex *mutex)
-{
-    semaphore_destroy((struct semaphore*) mutex);
-}
-
 static inline bool mutex_trylock(struct mutex *mutex)
 {
     return semaphore_trylock((struct semaphore*) mutex);
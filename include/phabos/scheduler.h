@@ -8,18 +8,46 @@
 #ifndef __SCHEDULER_H__
 #define __SCHEDULER_H__
 
+#include <config.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include <asm/scheduler.h>
 #include <phabos/list.h>
 #include <phabos/mutex.h>
+#include <phabos/watchdog.h>
+
+/**
+ * Task priorities, a runnable task always preempts the lower priority ones.
+ * Tasks of the same priority share the CPU round-robin.
+ *
+ * TASK_PRIORITY_IDLE is reserved to the idle task.
+ */
+#define TASK_PRIORITY_IDLE      0
+#define TASK_PRIORITY_LOW       1
+#define TASK_PRIORITY_NORMAL    2
+#define TASK_PRIORITY_HIGH      3
+#define NR_TASK_PRIORITIES      4
+
+#define TASK_DEFAULT_STACK_SIZE 4096
+
+struct worker;
 
 struct task {
     int id;
     uint16_t state;
+    unsigned priority;
     register_t registers[MAX_REG];
     void *allocated_stack;
 
+    uint32_t notify_value;
+    uint32_t notify_mask;
+
+    unsigned long timer_slack;
+
+    /* set if the task is a workqueue worker */
+    struct worker *worker;
+
     struct list_head list;
 };
 
@@ -27,6 +55,18 @@ struct task_cond {
     struct list_head wait_list;
 };
 
+struct task_timeout {
+    struct watchdog watchdog;
+    struct task *task;
+    bool expired;
+};
+
+enum task_notify_action {
+    TASK_NOTIFY_SET_BITS,
+    TASK_NOTIFY_INCREMENT,
+    TASK_NOTIFY_OVERWRITE,
+};
+
 typedef void (*task_entry_t)(void *data);
 
 /**
@@ -52,27 +92,139 @@ void task_yield(void);
 void task_kill(struct task *task);
 
 void task_exit(void);
+
+/**
+ * Set the default slack of the timers armed by a task
+ *
+ * The slack lets the timer core delay the expiry of a timer by up to that
+ * many microseconds so that it can be batched with other expiries. New tasks
+ * inherit the slack of the task creating them.
+ */
+void task_set_timer_slack(struct task *task, unsigned long usec);
+
+/**
+ * Change the priority of a task
+ *
+ * New tasks are created with TASK_PRIORITY_NORMAL.
+ *
+ * Returns 0 on success, -EINVAL if the priority is out of range.
+ */
+int task_set_priority(struct task *task, unsigned priority);
+
 void task_add_to_wait_list(struct task *task, struct list_head *wait_list);
 void task_remove_from_wait_list(struct task *task);
 
+/**
+ * Put the running task to sleep on a wait list
+ *
+ * Must be called with interrupts disabled. They are re-enabled while the task
+ * sleeps and are disabled again when it is woken up.
+ *
+ * wait_list: list the task will be added to until someone wakes it up
+ */
+void task_wait(struct list_head *wait_list);
+
+/**
+ * Wake up a task waiting on a wait list and switch to it as soon as possible
+ *
+ * Unlike task_remove_from_wait_list(), the task is put at the front of the
+ * runqueue so that it does not have to wait for the other tasks' time slices.
+ * Does nothing if the task is not waiting.
+ */
+void task_wake_up_preempt(struct task *task);
+
+/**
+ * Arm a timeout for the running task
+ *
+ * When the timeout expires, timeout->expired is set and the task is removed
+ * from the wait list it is sleeping on, if any.
+ *
+ * timeout: timeout storage, must live until task_timeout_stop() is called
+ * usec: delay in microseconds
+ */
+void task_timeout_start(struct task_timeout *timeout, unsigned long usec);
+void task_timeout_stop(struct task_timeout *timeout);
+
 /**
  * Run a new task
  *
  * Add a new task to the scheduler runqueue and returns its task id.
  * The new task will not preempt the current and will have to wait to be chosen
- * by the scheduler to be run.
+ * by the scheduler to be run. It starts with TASK_PRIORITY_NORMAL.
  *
  * task: Pointer to the new task
  * data: data shared with the new task
  * stack_addr: top of the stack for the task
  */
+#ifndef CONFIG_STATIC_KERNEL
 struct task *task_run(task_entry_t task, void *data, uint32_t stack_addr);
 
+/**
+ * Create a new task without running it
+ *
+ * The task can be set up, for instance with task_set_priority(), before it
+ * gets a chance to run. task_start() then adds it to the runqueue.
+ */
+struct task *task_create(task_entry_t task, void *data, uint32_t stack_addr);
+#endif
+
+/**
+ * Run a new task using storage provided by the caller
+ *
+ * Same as task_run() but nothing is allocated, and nothing is freed when the
+ * task exits: the task structure and the stack can be reused afterward.
+ *
+ * task: task storage, must not be in use
+ * entry: entry point of the new task
+ * data: data shared with the new task
+ * stack: lowest address of the stack
+ * stack_size: size of the stack in bytes
+ */
+struct task *task_run_static(struct task *task, task_entry_t entry, void *data,
+                             void *stack, size_t stack_size);
+
+/**
+ * Same as task_run_static() but the task is not started, see task_create()
+ */
+struct task *task_init(struct task *task, task_entry_t entry, void *data,
+                       void *stack, size_t stack_size);
+
+/**
+ * Add a task created by task_create() or task_init() to the runqueue
+ */
+void task_start(struct task *task);
+
 /**
  * Get the task ID of the running task
  */
 struct task *task_get_running(void);
 
+/**
+ * Send a notification to a task
+ *
+ * Update the notification word of the task and wake it up if it is waiting
+ * for any of the bits that are now set. Can be called from an interrupt.
+ *
+ * task: task to notify
+ * bits: value used to update the notification word
+ * action: how the notification word is updated with bits
+ */
+void task_notify(struct task *task, uint32_t bits,
+                 enum task_notify_action action);
+
+/**
+ * Wait for a notification
+ *
+ * Sleep until at least one of the bits in mask is set in the notification
+ * word of the running task. The matching bits are cleared before returning.
+ *
+ * mask: bits to wait for
+ * timeout: maximum time to wait in microseconds, 0 to wait forever
+ *
+ * Returns the bits of the notification word matching mask, 0 on timeout.
+ */
+uint32_t task_notify_wait(uint32_t mask, unsigned long timeout);
+
 void sched_lock(void);
 void sched_unlock(void);
 
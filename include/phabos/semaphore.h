@@ -8,6 +8,7 @@
 #ifndef __SEMAPHORE_H__
 #define __SEMAPHORE_H__
 
+#include <config.h>
 #include <asm/atomic.h>
 #include <phabos/list.h>
 #include <phabos/assert.h>
@@ -17,12 +18,20 @@ struct semaphore {
     atomic_t count;
 };
 
+#define SEMAPHORE_INIT(x, val) {                \
+    .wait_list = LIST_INIT((x).wait_list),      \
+    .count = (val),                             \
+}
+
+#ifndef CONFIG_STATIC_KERNEL
 struct semaphore *semaphore_create(unsigned val);
+void semaphore_destroy(struct semaphore *semaphore);
+#endif
+
 void semaphore_init(struct semaphore *semaphore, unsigned val);
 void semaphore_lock(struct semaphore *semaphore);
 bool semaphore_trylock(struct semaphore *semaphore);
 void semaphore_unlock(struct semaphore *semaphore);
-void semaphore_destroy(struct semaphore *semaphore);
 
 static inline void semaphore_up(struct semaphore *semaphore)
 {
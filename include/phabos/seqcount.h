@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __SEQCOUNT_H__
+#define __SEQCOUNT_H__
+
+#include <stdbool.h>
+#include <asm/barrier.h>
+#include <asm/spinlock.h>
+
+/*
+ * Sequence counters let readers access data without locking while a writer
+ * may update it. The writer makes the sequence odd while it is updating the
+ * data, and the readers retry until they see the same even sequence before
+ * and after reading.
+ *
+ * A reader spins while an update is in progress, so a writer must never be
+ * preempted by a reader of the same data: either update from the highest
+ * priority context reading it (e.g. the SysTick handler) or use a seqlock.
+ *
+ *  do {
+ *      seq = read_seqcount_begin(&seqcount);
+ *      ...copy the data...
+ *  } while (read_seqcount_retry(&seqcount, seq));
+ *
+ * phabos only runs on a single core, so compiler barriers are enough to
+ * order the sequence accesses against the data accesses.
+ */
+
+struct seqcount {
+    unsigned sequence;
+};
+
+#define SEQCOUNT_INIT(x) { .sequence = 0 }
+
+static inline void seqcount_init(struct seqcount *seqcount)
+{
+    seqcount->sequence = 0;
+}
+
+static inline unsigned read_seqcount_begin(struct seqcount *seqcount)
+{
+    unsigned sequence;
+
+    do {
+        sequence = *(volatile unsigned*) &seqcount->sequence;
+    } while (sequence & 1);
+
+    compiler_barrier();
+    return sequence;
+}
+
+static inline bool read_seqcount_retry(struct seqcount *seqcount,
+                                       unsigned sequence)
+{
+    compiler_barrier();
+    return *(volatile unsigned*) &seqcount->sequence != sequence;
+}
+
+static inline void write_seqcount_begin(struct seqcount *seqcount)
+{
+    seqcount->sequence++;
+    compiler_barrier();
+}
+
+static inline void write_seqcount_end(struct seqcount *seqcount)
+{
+    compiler_barrier();
+    seqcount->sequence++;
+}
+
+/*
+ * A seqlock is a sequence counter whose writers are serialized with a
+ * spinlock, which also keeps readers from preempting the writer.
+ */
+struct seqlock {
+    struct seqcount seqcount;
+    struct spinlock lock;
+};
+
+#define SEQLOCK_INIT(x) { \
+    .seqcount = SEQCOUNT_INIT((x).seqcount), \
+    .lock = SPINLOCK_INIT((x).lock), \
+}
+
+static inline void seqlock_init(struct seqlock *seqlock)
+{
+    seqcount_init(&seqlock->seqcount);
+    spinlock_init(&seqlock->lock);
+}
+
+static inline unsigned read_seqbegin(struct seqlock *seqlock)
+{
+    return read_seqcount_begin(&seqlock->seqcount);
+}
+
+static inline bool read_seqretry(struct seqlock *seqlock, unsigned sequence)
+{
+    return read_seqcount_retry(&seqlock->seqcount, sequence);
+}
+
+static inline void write_seqlock(struct seqlock *seqlock)
+{
+    spinlock_lock(&seqlock->lock);
+    write_seqcount_begin(&seqlock->seqcount);
+}
+
+static inline void write_sequnlock(struct seqlock *seqlock)
+{
+    write_seqcount_end(&seqlock->seqcount);
+    spinlock_unlock(&seqlock->lock);
+}
+
+#endif /* __SEQCOUNT_H__ */
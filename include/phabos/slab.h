@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+#include <asm/atomic.h>
+#include <phabos/list.h>
+#include <phabos/kmalloc.h>
+
+struct kmem_slab;
+
+/**
+ * Cache of fixed-size objects
+ *
+ * Objects are carved out of slabs allocated from the kernel heap and are
+ * kept in a free list once released, slabs are only given back when the cache
+ * is destroyed. Allocating and freeing objects is lock-free and can be done
+ * from interrupt context.
+ *
+ * ctor: called once for each object when its slab is allocated, objects must
+ *       be freed back to the cache in their constructed state
+ * free_list: free objects, the link to the next one is at free_offset
+ */
+struct kmem_cache {
+    const char *name;
+    size_t object_size;
+    size_t align;
+    void (*ctor)(void *object);
+    unsigned flags;
+
+    size_t size;
+    size_t free_offset;
+    unsigned objects_per_slab;
+
+    void *free_list;
+    struct kmem_slab *slabs;
+
+    atomic_t nr_active;
+    atomic_t nr_objects;
+    atomic_t nr_slabs;
+    atomic_t nr_allocs;
+
+    struct list_head list;
+};
+
+/**
+ * Statically define a cache, its layout is computed on first allocation
+ */
+#define KMEM_CACHE_INIT(x, _name, _size, _ctor) {   \
+    .name = (_name),                                \
+    .object_size = (_size),                         \
+    .ctor = (_ctor),                                \
+    .list = LIST_INIT((x).list),                    \
+}
+
+/**
+ * Initialize a cache
+ *
+ * align: minimum alignment of the objects, 0 for the default of 8 bytes
+ */
+void kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size,
+                     size_t align, void (*ctor)(void *object));
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, void (*ctor)(void *object));
+
+/**
+ * Release the memory of a cache, all its objects must have been freed
+ */
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+/**
+ * Allocate an object
+ *
+ * flags: MM_ZERO to clear the object, can't be used with a constructor
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache, unsigned flags);
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+#endif /* __SLAB_H__ */
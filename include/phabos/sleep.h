@@ -9,8 +9,40 @@
 #define __LIB_SLEEP_H__
 
 #include <time.h>
+#include <phabos/ktime.h>
+
+#ifndef TIMER_ABSTIME
+#define TIMER_ABSTIME 4
+#endif
 
 int usleep(useconds_t usec);
 
+/**
+ * Sleep for at least the requested time, with microsecond accuracy
+ *
+ * Returns 0 on success, -EINVAL if req is not a valid time.
+ */
+int nanosleep(const struct timespec *req, struct timespec *rem);
+
+/**
+ * Sleep on a monotonic clock
+ *
+ * With TIMER_ABSTIME in flags, req is the absolute time to wake up at,
+ * otherwise it is relative to now like nanosleep().
+ */
+int clock_nanosleep(clockid_t clock_id, int flags,
+                    const struct timespec *req, struct timespec *rem);
+
+/**
+ * Sleep until last_wake + period, for tasks running at a fixed cadence
+ *
+ * last_wake is advanced by period on every call, so the wake up times do not
+ * drift with the time spent running the task. Initialize it with ktime_get()
+ * before the first call.
+ *
+ * Returns 0, or -ETIMEDOUT without sleeping if the deadline already passed.
+ */
+int task_delay_until(ktime_t *last_wake, ktime_t period);
+
 #endif /* __LIB_SLEEP_H__ */
 
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __SOFTIRQ_H__
+#define __SOFTIRQ_H__
+
+/*
+ * Softirqs run from the lowest priority exception, with the interrupts
+ * enabled, once all the hardware interrupt handlers have returned. Like
+ * interrupt handlers, they must never block.
+ */
+enum softirq {
+    TIMER_SOFTIRQ,
+    NR_SOFTIRQS,
+};
+
+typedef void (*softirq_handler_t)(void);
+
+void softirq_register(enum softirq nr, softirq_handler_t handler);
+
+/**
+ * Mark a softirq as pending, can be called from any context
+ */
+void softirq_raise(enum softirq nr);
+
+/**
+ * Run the pending softirqs, called by the architecture code
+ */
+void softirq_run(void);
+
+/**
+ * Trigger the exception running the softirqs, implemented by each
+ * architecture
+ */
+void softirq_arch_raise(void);
+
+#endif /* __SOFTIRQ_H__ */
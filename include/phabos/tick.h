@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __TICK_H__
+#define __TICK_H__
+
+#include <stdint.h>
+#include <config.h>
+#include <phabos/ktime.h>
+
+/* configurations predating the tick rate option ran at 1000 Hz */
+#ifdef CONFIG_HZ
+#define HZ              CONFIG_HZ
+#else
+#define HZ              1000
+#endif
+
+#if HZ > 1000 || 1000 % HZ
+#error "HZ must divide one second in milliseconds"
+#endif
+
+#define MSEC_PER_TICK   (1000 / HZ)
+#define USEC_PER_TICK   (USEC_PER_SEC / HZ)
+#define NSEC_PER_TICK   (NSEC_PER_SEC / HZ)
+
+/*
+ * All the divisors below are compile-time constants smaller than 2^32, so
+ * the conversions compile to multiplications and shifts.
+ */
+
+/**
+ * Convert microseconds to ticks, rounding up
+ */
+static inline uint32_t usecs_to_ticks(uint32_t usec)
+{
+    return usec / USEC_PER_TICK + !!(usec % USEC_PER_TICK);
+}
+
+static inline uint32_t msecs_to_ticks(uint32_t msec)
+{
+    return msec / MSEC_PER_TICK + !!(msec % MSEC_PER_TICK);
+}
+
+static inline uint64_t ticks_to_usecs(uint64_t ticks)
+{
+    return ticks * USEC_PER_TICK;
+}
+
+static inline ktime_t ticks_to_ns(uint64_t ticks)
+{
+    return ticks * NSEC_PER_TICK;
+}
+
+#endif /* __TICK_H__ */
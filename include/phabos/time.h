@@ -10,7 +10,15 @@
 
 #include <time.h>
 
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW ((clockid_t) 5)
+#endif
+
+/**
+ * Supported clocks are CLOCK_MONOTONIC and CLOCK_MONOTONIC_RAW, both with
+ * the resolution of the current clocksource.
+ */
 int clock_gettime(clockid_t clk_id, struct timespec *tp);
+int clock_getres(clockid_t clk_id, struct timespec *res);
 
 #endif /* __LIB_TIME_H__ */
-
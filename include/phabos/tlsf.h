@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#ifndef __TLSF_H__
+#define __TLSF_H__
+
+#include <stddef.h>
+
+/**
+ * Two-Level Segregated Fit allocator
+ *
+ * Allocation and release run in constant time whatever the state of the
+ * heap. Free blocks are sorted in size classes: a first level of power of two
+ * ranges, each split linearly in a second level. Returned pointers are 8-byte
+ * aligned.
+ *
+ * None of these functions lock, the caller is responsible for that.
+ */
+struct tlsf;
+
+/**
+ * total: bytes managed by the allocator
+ * used: bytes in allocated blocks, block headers included
+ * peak: highest value reached by used
+ * largest_free: size of the largest free block, an allocation that big can
+ *               still fail as requests are rounded up to their size class
+ */
+struct tlsf_stats {
+    size_t total;
+    size_t used;
+    size_t peak;
+    size_t largest_free;
+    unsigned free_blocks;
+};
+
+/**
+ * Create an allocator managing a memory area
+ *
+ * The allocator state is stored at the beginning of the area.
+ *
+ * Returns NULL if the area is too small.
+ */
+struct tlsf *tlsf_create(void *mem, size_t size);
+
+void *tlsf_malloc(struct tlsf *tlsf, size_t size);
+void *tlsf_memalign(struct tlsf *tlsf, size_t alignment, size_t size);
+void *tlsf_realloc(struct tlsf *tlsf, void *ptr, size_t size);
+void tlsf_free(struct tlsf *tlsf, void *ptr);
+
+/**
+ * Returns the number of bytes usable in an allocated block
+ */
+size_t tlsf_block_size(void *ptr);
+
+/**
+ * Get the usage of the allocator
+ *
+ * Walks all the free blocks, so this is not a constant time operation.
+ */
+void tlsf_get_stats(struct tlsf *tlsf, struct tlsf_stats *stats);
+
+#endif /* __TLSF_H__ */
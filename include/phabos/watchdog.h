@@ -8,17 +8,70 @@
 #ifndef __WATCHDOG_H__
 #define __WATCHDOG_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <phabos/list.h>
+
+/**
+ * Context the timeout callback is executed from
+ *
+ * WATCHDOG_CONTEXT_SOFTIRQ: right after the tick interrupt, must not block
+ * WATCHDOG_CONTEXT_TASK: from the timer task, can block
+ */
+enum watchdog_context {
+    WATCHDOG_CONTEXT_SOFTIRQ,
+    WATCHDOG_CONTEXT_TASK,
+};
+
+/* Use the timer slack of the task arming the watchdog */
+#define WATCHDOG_SLACK_DEFAULT  ULONG_MAX
+
+/**
+ * slack: how late in microseconds the watchdog is allowed to expire, so that
+ *        it can be coalesced with other watchdogs
+ * overruns: for periodic watchdogs, number of periods skipped right before
+ *           the current expiry because the callback ran too late
+ */
 struct watchdog {
     void (*timeout)(struct watchdog *wd);
-    void *priv;
     void *user_priv;
+    enum watchdog_context context;
+    unsigned long slack;
+    unsigned overruns;
+
+    uint64_t end;
+    uint32_t period;
+    struct list_head list;
 };
 
+#define WATCHDOG_INIT(x, callback) {       \
+    .timeout = (callback),                  \
+    .slack = WATCHDOG_SLACK_DEFAULT,        \
+    .list = LIST_INIT((x).list),            \
+}
+
 void watchdog_start(struct watchdog *wd, unsigned long timeout);
+
+/**
+ * Start a watchdog expiring every period microseconds, until cancelled
+ *
+ * Each expiry is scheduled exactly one period after the previous one, not
+ * after the callback ran, so the period does not drift. The period is rounded
+ * up to a whole number of ticks.
+ */
+void watchdog_start_periodic(struct watchdog *wd, unsigned long period);
 void watchdog_cancel(struct watchdog *wd);
 void watchdog_init(struct watchdog *wd);
 void watchdog_delete(struct watchdog *wd);
 bool watchdog_has_expired(struct watchdog *wd);
 
+/**
+ * Start the task running the WATCHDOG_CONTEXT_TASK callbacks
+ *
+ * Must be called once, from thread context, after scheduler_init().
+ */
+void watchdog_timer_task_init(void);
+
 #endif /* __WATCHDOG_H__ */
 
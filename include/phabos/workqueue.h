@@ -8,40 +8,254 @@
 #ifndef __WORKQUEUE_H__
 #define __WORKQUEUE_H__
 
+#include <config.h>
+#include <stdint.h>
 #include <asm/spinlock.h>
-#include <phabos/semaphore.h>
+#include <asm/atomic.h>
+#include <phabos/completion.h>
 #include <phabos/list.h>
 #include <phabos/watchdog.h>
 
 typedef void (*work_entry_t)(void *data);
 
+struct task;
+struct worker_pool;
+
+/**
+ * Priority bands of the works within a workqueue
+ *
+ * Ready works of a more urgent band always run first, works of the same band
+ * run in FIFO order.
+ */
+enum work_band {
+    WORK_BAND_HIGH,
+    WORK_BAND_NORMAL,
+    WORK_BAND_LOW,
+    NR_WORK_BANDS,
+};
+
+/* run the works of the workqueue with TASK_PRIORITY_HIGH workers */
+#define WQ_HIGHPRI  (1 << 0)
+
+#ifdef CONFIG_WORKQUEUE_STATS
+
+#define WQ_STATS_NR_BUCKETS     32
+#define WQ_STATS_NR_CALLBACKS   8
+
+/**
+ * Histogram buckets are log2 of nanoseconds: bucket n counts the durations in
+ * [2^n, 2^(n+1)) ns, bucket 0 also counts the ones below 1 ns.
+ *
+ * depth: works ready to run and not started yet
+ * callbacks: run count of the first callbacks seen, the other ones are
+ *            accounted in other_callbacks
+ */
+struct workqueue_stats {
+    unsigned depth;
+    unsigned max_depth;
+    uint32_t queued;
+    uint32_t latency[WQ_STATS_NR_BUCKETS];
+    uint32_t exec[WQ_STATS_NR_BUCKETS];
+
+    struct {
+        work_entry_t callback;
+        uint32_t count;
+    } callbacks[WQ_STATS_NR_CALLBACKS];
+    uint32_t other_callbacks;
+};
+
+#endif
+
+/**
+ * list: works ready to run, one FIFO per band
+ * delayed_list: delayed works waiting for their timer to expire
+ * pool_list: node in the pool list of workqueues having work to hand out
+ * max_active: maximum number of works of this queue running concurrently
+ */
 struct workqueue {
-    struct task *task;
     const char *name;
-    struct list_head list;
-    struct semaphore semaphore;
-    struct semaphore empty_semaphore;
-    struct spinlock lock;
+    struct worker_pool *pool;
+    struct list_head list[NR_WORK_BANDS];
+    struct list_head delayed_list;
+    struct list_head pool_list;
+    struct completion empty;
     atomic_t work_count;
+
+    unsigned max_active;
+    unsigned nr_active;
+    struct list_head flush_wait_list;
+
+#ifdef CONFIG_WORKQUEUE_STATS
+    struct workqueue_stats stats;
+    struct list_head stats_list;
+#endif
 };
 
+/**
+ * Work item, can be embedded in any structure and queued again as soon as
+ * it has started running.
+ *
+ * The structure must not be modified while the work is pending. It can be
+ * freed from its own callback.
+ */
 struct work {
     work_entry_t entry_point;
     void *data;
-    bool is_schedulable;
+    unsigned flags;
+    enum work_band band;
+
+#ifdef CONFIG_WORKQUEUE_STATS
+    uint32_t ready_cycles;
+#endif
 
-    struct watchdog watchdog;
     struct workqueue *wq;
     struct list_head list;
 };
 
+struct delayed_work {
+    struct work work;
+    struct watchdog watchdog;
+};
+
+#define WORK_INIT(x, callback, priv) {      \
+    .entry_point = (callback),              \
+    .data = (priv),                         \
+    .band = WORK_BAND_NORMAL,               \
+    .list = LIST_INIT((x).list),            \
+}
+
+void work_init(struct work *work, work_entry_t callback, void *data);
+void delayed_work_init(struct delayed_work *dwork, work_entry_t callback,
+                       void *data);
+
+/**
+ * Set the priority band of a work, WORK_BAND_NORMAL by default
+ *
+ * Must not be called while the work is pending.
+ */
+void work_set_band(struct work *work, enum work_band band);
+
+/**
+ * Queue a work to be executed by the workqueue
+ *
+ * Can be called from interrupt context.
+ *
+ * Returns false if the work was already pending, in which case nothing is
+ * done.
+ */
+bool workqueue_queue_work(struct workqueue *wq, struct work *work);
+
+/**
+ * Queue a work to be executed by the workqueue after a delay
+ *
+ * delay: time to wait in microseconds before queueing the work
+ *
+ * Returns false if the work was already pending, in which case nothing is
+ * done.
+ */
+bool workqueue_queue_delayed_work(struct workqueue *wq,
+                                  struct delayed_work *dwork,
+                                  unsigned long delay);
+
+/**
+ * Returns true if the work is queued and did not start running yet
+ */
+bool work_is_pending(struct work *work);
+
+/**
+ * Remove a pending work from its workqueue
+ *
+ * This does not wait for the work if it is already running.
+ *
+ * Returns true if the work was pending.
+ */
+bool work_cancel(struct work *work);
+bool delayed_work_cancel(struct delayed_work *dwork);
+
+/**
+ * Wait until the work is neither pending nor running anymore
+ */
+void work_flush(struct work *work);
+
+/**
+ * Initialize a workqueue
+ *
+ * Workqueues don't own a task, their works are run by the workers of a
+ * shared pool. The pool keeps a single worker running at a time and only
+ * wakes up another one when the running worker blocks.
+ *
+ * flags: WQ_HIGHPRI to run the works on the high priority pool
+ * max_active: maximum number of works running concurrently
+ *
+ * Returns 0 on success, -ENOMEM if the pool has no worker and none can be
+ * created.
+ */
+int workqueue_init(struct workqueue *wq, const char *name, unsigned flags,
+                   unsigned max_active);
+
+/**
+ * Cancel the pending works and wait for the running ones to complete
+ *
+ * The workqueue can be initialized again afterward.
+ */
+void workqueue_deinit(struct workqueue *wq);
+
+#ifndef CONFIG_STATIC_KERNEL
+/**
+ * Create a workqueue running its works one at a time, in order
+ */
 struct workqueue *workqueue_create(const char *name);
+
+/**
+ * Allocate and initialize a workqueue, see workqueue_init()
+ */
+struct workqueue *workqueue_alloc(const char *name, unsigned flags,
+                                  unsigned max_active);
 void workqueue_destroy(struct workqueue *wq);
+#endif
+
+/**
+ * Shared workqueues, created on first use
+ *
+ * Use the high priority one for short latency-sensitive works such as
+ * completing a transfer, and the normal one for housekeeping.
+ */
+struct workqueue *system_workqueue(void);
+struct workqueue *system_highpri_workqueue(void);
+
+/**
+ * Set how many works of the workqueue may run concurrently
+ *
+ * Works running concurrently can complete in any order.
+ */
+int workqueue_set_max_active(struct workqueue *wq, unsigned max_active);
+
+#ifndef CONFIG_STATIC_KERNEL
+/*
+ * Same as workqueue_queue_work() and workqueue_queue_delayed_work() but the
+ * work item is allocated for each call.
+ */
 void workqueue_queue(struct workqueue *wq, work_entry_t callback, void *data);
 void workqueue_schedule(struct workqueue *wq, work_entry_t callback,
                         void *data, uint32_t delay);
+#endif
+
 bool workqueue_has_pending_work(struct workqueue *wq);
+
+/**
+ * Wait until all the work queued in the workqueue has been executed
+ *
+ * timeout: maximum time to wait in microseconds, 0 to wait forever
+ *
+ * Returns 0 if the workqueue is empty, -ETIMEDOUT if the timeout expired.
+ */
 int workqueue_wait_empty(struct workqueue *wq, int timeout);
 
-#endif /* __WORKQUEUE_H__ */
+/*
+ * Called by the scheduler, with the interrupts disabled, when a worker task
+ * blocks or becomes runnable again.
+ */
+void workqueue_worker_sleeping(struct task *task);
+void workqueue_worker_waking_up(struct task *task);
 
+#endif /* __WORKQUEUE_H__ */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <errno.h>
+
+#include <phabos/clockevent.h>
+#include <phabos/clocksource.h>
+#include <phabos/assert.h>
+#include <phabos/div64.h>
+#include <asm/irq.h>
+
+static struct list_head clockevents = LIST_INIT(clockevents);
+static struct clockevent *clockevent;
+
+int clockevent_register(struct clockevent *ce)
+{
+    struct clockevent *old;
+
+    RET_IF_FAIL(ce, -EINVAL);
+    RET_IF_FAIL(ce->features, -EINVAL);
+    RET_IF_FAIL(!(ce->features & CLOCKEVENT_FEAT_ONESHOT) ||
+                ce->set_next_event, -EINVAL);
+    RET_IF_FAIL(!(ce->features & CLOCKEVENT_FEAT_PERIODIC) ||
+                ce->set_periodic, -EINVAL);
+    RET_IF_FAIL(ce->freq > 0 && ce->freq < NSEC_PER_SEC, -EINVAL);
+    RET_IF_FAIL(ce->min_delta <= ce->max_delta, -EINVAL);
+
+    ce->max_delta_ns = div_u64((uint64_t) ce->max_delta * NSEC_PER_SEC,
+                               ce->freq);
+    clocks_calc_mult_shift(&ce->mult, &ce->shift, NSEC_PER_SEC, ce->freq,
+                           div_u64(ce->max_delta_ns, NSEC_PER_SEC) + 1);
+
+    irq_disable();
+
+    list_add(&clockevents, &ce->list);
+
+    old = clockevent;
+    if (!old || ce->rating > old->rating) {
+        if (old) {
+            ce->event_handler = old->event_handler;
+            old->event_handler = NULL;
+            if (old->shutdown)
+                old->shutdown(old);
+        }
+
+        clockevent = ce;
+    }
+
+    irq_enable();
+
+    return 0;
+}
+
+struct clockevent *clockevent_get(void)
+{
+    return clockevent;
+}
+
+static uint32_t clockevent_ns2cycles(struct clockevent *ce, ktime_t delta)
+{
+    uint64_t cycles;
+
+    if (delta > ce->max_delta_ns)
+        delta = ce->max_delta_ns;
+
+    /* round up so that the event never fires before its expiry time */
+    cycles = ((delta * ce->mult) >> ce->shift) + 1;
+
+    if (cycles < ce->min_delta)
+        cycles = ce->min_delta;
+    if (cycles > ce->max_delta)
+        cycles = ce->max_delta;
+
+    return cycles;
+}
+
+int clockevent_program(struct clockevent *ce, ktime_t expires)
+{
+    ktime_t now = ktime_get();
+
+    RET_IF_FAIL(ce, -EINVAL);
+
+    if (!(ce->features & CLOCKEVENT_FEAT_ONESHOT))
+        return -ENOTSUP;
+
+    return ce->set_next_event(ce, clockevent_ns2cycles(ce, expires > now ?
+                                                           expires - now : 0));
+}
+
+int clockevent_set_periodic(struct clockevent *ce, ktime_t period)
+{
+    RET_IF_FAIL(ce, -EINVAL);
+    RET_IF_FAIL(period, -EINVAL);
+
+    if (!(ce->features & CLOCKEVENT_FEAT_PERIODIC))
+        return -ENOTSUP;
+
+    return ce->set_periodic(ce, clockevent_ns2cycles(ce, period));
+}
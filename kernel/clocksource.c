@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <errno.h>
+
+#include <phabos/clocksource.h>
+#include <phabos/assert.h>
+#include <phabos/div64.h>
+#include <asm/scheduler.h>
+#include <asm/irq.h>
+
+#define CLOCKSOURCE_MAX_SEC 600
+
+static struct list_head clocksources = LIST_INIT(clocksources);
+
+/*
+ * Time at the last update is kept as nanoseconds plus a fraction of
+ * nanosecond shifted by the clocksource shift, so that converting the
+ * cycles in small chunks does not lose any precision.
+ */
+static struct clocksource *clocksource;
+static uint32_t cycle_last;
+static ktime_t base_ns;
+static uint64_t base_frac;
+
+void clocks_calc_mult_shift(uint32_t *mult, uint32_t *shift, uint32_t from,
+                            uint32_t to, uint32_t maxsec)
+{
+    uint64_t max_from = (uint64_t) maxsec * from;
+    unsigned max_from_bits = max_from ? 64 - __builtin_clzll(max_from) : 0;
+    unsigned mult_bits;
+    uint32_t best_mult = 0;
+    uint32_t best_shift = 0;
+
+    /*
+     * from_value * mult must fit in 64 bits for every value up to max_from,
+     * and mult itself must fit in 32 bits.
+     */
+    mult_bits = max_from_bits > 32 ? 64 - max_from_bits : 32;
+
+    /*
+     * mult grows with the shift, and a larger shift gives a finer
+     * conversion: keep the last shift whose rounded mult still fits.
+     */
+    for (uint32_t s = 0; s <= 32; s++) {
+        uint64_t m = div_u64(((uint64_t) to << s) + from / 2, from);
+
+        if (s > 0 && (m >> mult_bits))
+            break;
+
+        best_mult = m;
+        best_shift = s;
+    }
+
+    *mult = best_mult;
+    *shift = best_shift;
+}
+
+/**
+ * Must be called inside the clock_seqcount write section
+ */
+static void timekeeping_update(void)
+{
+    uint32_t now;
+    uint64_t snsec;
+
+    if (!clocksource)
+        return;
+
+    now = clocksource->read(clocksource);
+    snsec = (uint64_t) ((now - cycle_last) & clocksource->mask) *
+            clocksource->mult + base_frac;
+
+    base_ns += snsec >> clocksource->shift;
+    base_frac = snsec & ((1ULL << clocksource->shift) - 1);
+    cycle_last = now;
+}
+
+void timekeeping_tick(void)
+{
+    timekeeping_update();
+}
+
+static void timekeeping_set_clocksource(struct clocksource *cs)
+{
+    irq_disable();
+    write_seqcount_begin(&clock_seqcount);
+
+    timekeeping_update();
+
+    clocksource = cs;
+    cycle_last = cs->read(cs);
+    base_frac = 0;
+
+    write_seqcount_end(&clock_seqcount);
+    irq_enable();
+}
+
+int clocksource_register(struct clocksource *cs)
+{
+    uint32_t maxsec;
+
+    RET_IF_FAIL(cs, -EINVAL);
+    RET_IF_FAIL(cs->read, -EINVAL);
+    RET_IF_FAIL(cs->freq > 0, -EINVAL);
+    RET_IF_FAIL(cs->mask > 0, -EINVAL);
+
+    maxsec = cs->mask / cs->freq;
+    if (!maxsec)
+        maxsec = 1;
+    else if (maxsec > CLOCKSOURCE_MAX_SEC)
+        maxsec = CLOCKSOURCE_MAX_SEC;
+
+    clocks_calc_mult_shift(&cs->mult, &cs->shift, cs->freq, NSEC_PER_SEC,
+                           maxsec);
+
+    irq_disable();
+    list_add(&clocksources, &cs->list);
+    irq_enable();
+
+    if (!clocksource || cs->rating > clocksource->rating)
+        timekeeping_set_clocksource(cs);
+
+    return 0;
+}
+
+struct clocksource *clocksource_get(void)
+{
+    return clocksource;
+}
+
+ktime_t ktime_get(void)
+{
+    struct clocksource *cs;
+    uint64_t snsec;
+    ktime_t ns;
+    unsigned seq;
+
+    do {
+        seq = read_seqcount_begin(&clock_seqcount);
+
+        cs = clocksource;
+        ns = base_ns;
+        if (cs) {
+            snsec = (uint64_t) ((cs->read(cs) - cycle_last) & cs->mask) *
+                    cs->mult + base_frac;
+            ns += snsec >> cs->shift;
+        }
+    } while (read_seqcount_retry(&clock_seqcount, seq));
+
+    return ns;
+}
+
+uint32_t ktime_get_cycles(void)
+{
+    struct clocksource *cs = clocksource;
+
+    return cs ? cs->read(cs) : 0;
+}
+
+ktime_t ktime_cycles_to_ns(uint32_t cycles)
+{
+    struct clocksource *cs = clocksource;
+
+    if (!cs)
+        return 0;
+
+    return clocksource_cyc2ns(cycles & cs->mask, cs->mult, cs->shift);
+}
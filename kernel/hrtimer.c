@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include <phabos/hrtimer.h>
+#include <phabos/clockevent.h>
+#include <phabos/assert.h>
+#include <asm/spinlock.h>
+
+/*
+ * Pending timers are kept sorted by their latest expiry time (expires +
+ * slack), and the clockevent is always programmed for the first one. When it
+ * fires, the queue is walked up to the first timer whose latest expiry time is
+ * still in the future, and every timer on the way whose earliest expiry time
+ * has passed is run. Timers with overlapping windows are thereby batched on a
+ * single interrupt.
+ */
+static struct list_head hrtimer_queue = LIST_INIT(hrtimer_queue);
+static struct spinlock hrtimer_lock = SPINLOCK_INIT(hrtimer_lock);
+static struct clockevent *hrtimer_clockevent;
+
+static void hrtimer_interrupt(struct clockevent *ce);
+
+static inline ktime_t hrtimer_hard_expires(struct hrtimer *timer)
+{
+    return timer->expires + timer->slack;
+}
+
+/**
+ * Must be called with hrtimer_lock held
+ */
+static void hrtimer_reprogram(void)
+{
+    struct clockevent *ce = clockevent_get();
+    struct hrtimer *timer;
+
+    if (!ce)
+        return;
+
+    if (ce != hrtimer_clockevent) {
+        ce->event_handler = hrtimer_interrupt;
+        hrtimer_clockevent = ce;
+    }
+
+    if (list_is_empty(&hrtimer_queue)) {
+        if (ce->shutdown)
+            ce->shutdown(ce);
+        return;
+    }
+
+    timer = list_first_entry(&hrtimer_queue, struct hrtimer, list);
+    clockevent_program(ce, hrtimer_hard_expires(timer));
+}
+
+/**
+ * Must be called with hrtimer_lock held
+ *
+ * Returns the first timer that can be run at time now, or NULL
+ */
+static struct hrtimer *hrtimer_next_expired(ktime_t now)
+{
+    struct list_head *pos;
+
+    for (pos = hrtimer_queue.next; pos != &hrtimer_queue; pos = pos->next) {
+        struct hrtimer *timer = list_entry(pos, struct hrtimer, list);
+
+        if (timer->expires <= now)
+            return timer;
+
+        if (hrtimer_hard_expires(timer) > now)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * Run all the expired timers
+ *
+ * Returns true if at least one timer expired
+ */
+static bool hrtimer_expire(void)
+{
+    struct hrtimer *timer;
+    bool expired = false;
+
+    spinlock_lock(&hrtimer_lock);
+
+    /*
+     * The lock is dropped while a callback runs, and the callback may start
+     * or cancel timers, so the walk starts over from the head every time.
+     */
+    while ((timer = hrtimer_next_expired(ktime_get()))) {
+        list_del(&timer->list);
+        expired = true;
+
+        spinlock_unlock(&hrtimer_lock);
+        timer->function(timer);
+        spinlock_lock(&hrtimer_lock);
+    }
+
+    spinlock_unlock(&hrtimer_lock);
+
+    return expired;
+}
+
+static void hrtimer_interrupt(struct clockevent *ce)
+{
+    hrtimer_expire();
+
+    spinlock_lock(&hrtimer_lock);
+    hrtimer_reprogram();
+    spinlock_unlock(&hrtimer_lock);
+}
+
+void hrtimer_run_queues(void)
+{
+    if (!hrtimer_expire())
+        return;
+
+    spinlock_lock(&hrtimer_lock);
+    hrtimer_reprogram();
+    spinlock_unlock(&hrtimer_lock);
+}
+
+void hrtimer_init(struct hrtimer *timer)
+{
+    RET_IF_FAIL(timer,);
+
+    memset(timer, 0, sizeof(*timer));
+    list_init(&timer->list);
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t time, enum hrtimer_mode mode)
+{
+    struct list_head *pos;
+
+    RET_IF_FAIL(timer,);
+    RET_IF_FAIL(timer->function,);
+
+    if (mode == HRTIMER_MODE_REL)
+        time += ktime_get();
+
+    spinlock_lock(&hrtimer_lock);
+
+    if (!list_is_empty(&timer->list))
+        list_del(&timer->list);
+
+    timer->expires = time;
+
+    for (pos = hrtimer_queue.next; pos != &hrtimer_queue; pos = pos->next) {
+        struct hrtimer *t = list_entry(pos, struct hrtimer, list);
+        if (hrtimer_hard_expires(t) > hrtimer_hard_expires(timer))
+            break;
+    }
+    list_add(pos, &timer->list);
+
+    if (hrtimer_queue.next == &timer->list)
+        hrtimer_reprogram();
+
+    spinlock_unlock(&hrtimer_lock);
+}
+
+void hrtimer_cancel(struct hrtimer *timer)
+{
+    bool was_first;
+
+    RET_IF_FAIL(timer,);
+
+    spinlock_lock(&hrtimer_lock);
+
+    if (!list_is_empty(&timer->list)) {
+        was_first = hrtimer_queue.next == &timer->list;
+        list_del(&timer->list);
+
+        if (was_first)
+            hrtimer_reprogram();
+    }
+
+    spinlock_unlock(&hrtimer_lock);
+}
+
+bool hrtimer_is_queued(struct hrtimer *timer)
+{
+    RET_IF_FAIL(timer, false);
+    return !list_is_empty(&timer->list);
+}
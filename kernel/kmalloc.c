@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <phabos/kmalloc.h>
+#include <phabos/tlsf.h>
+#include <phabos/panic.h>
+#include <phabos/assert.h>
+#include <phabos/shell.h>
+#include <asm/spinlock.h>
+#include <asm/machine.h>
+
+uint32_t _sbrk(int incr);
+
+#define MM_REGION_FLAGS     (MM_FAST | MM_DMA)
+
+#ifndef MACH_HEAP_FLAGS
+#define MACH_HEAP_FLAGS     (MM_FAST | MM_DMA)
+#endif
+
+struct mm_region {
+    const char *name;
+    uintptr_t start;
+    uintptr_t end;
+    unsigned flags;
+    struct tlsf *heap;
+};
+
+#define MM_MIN_BUCKET_SIZE  8
+#define MM_NR_SIZE_BUCKETS  15
+#define MM_NR_CALLSITES     32
+
+/**
+ * sizes: number of allocations per requested size, the bucket n counts the
+ *        sizes up to MM_MIN_BUCKET_SIZE << n, the last one the larger sizes
+ */
+struct mm_stats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t sizes[MM_NR_SIZE_BUCKETS];
+#ifdef CONFIG_MM_CALLSITES
+    uint32_t untracked_allocs;
+#endif
+};
+
+#ifdef CONFIG_MM_CALLSITES
+struct mm_callsite {
+    void *caller;
+    uint32_t allocs;
+    uint32_t live_blocks;
+    uint32_t live_bytes;
+};
+
+static struct mm_callsite callsites[MM_NR_CALLSITES];
+#endif
+
+static struct spinlock kmalloc_lock = SPINLOCK_INIT(kmalloc_lock);
+static struct mm_stats mm_stats;
+
+/* the first region is the main heap, set up on first use */
+static struct mm_region regions[MM_MAX_REGIONS];
+static unsigned nr_regions = 1;
+
+/**
+ * Give the whole space between the break and the idle stack to the main heap
+ *
+ * Must be called with kmalloc_lock held
+ */
+static void kmalloc_init_main_heap(void)
+{
+    struct mm_region *region = &regions[0];
+    uint32_t start;
+    void *mem;
+
+    if (region->heap)
+        return;
+
+    start = _sbrk(0);
+    mem = (void *) _sbrk(KERNEL_HEAP_END - start);
+    if (mem == (void *) -1)
+        panic("kmalloc: no room for the heap\n");
+
+    region->name = "heap";
+    region->start = (uintptr_t) mem;
+    region->end = KERNEL_HEAP_END;
+    region->flags = MACH_HEAP_FLAGS;
+    region->heap = tlsf_create(mem, KERNEL_HEAP_END - start);
+    if (!region->heap)
+        panic("kmalloc: heap too small\n");
+}
+
+/**
+ * Must be called with kmalloc_lock held
+ */
+static struct mm_region *mm_find_region(void *ptr)
+{
+    for (unsigned i = 0; i < nr_regions; i++) {
+        if ((uintptr_t) ptr >= regions[i].start &&
+            (uintptr_t) ptr < regions[i].end)
+            return &regions[i];
+    }
+
+    return NULL;
+}
+
+int mm_add_region(const char *name, void *start, size_t size, unsigned flags)
+{
+    struct mm_region *region;
+    struct tlsf *heap;
+    int retval = 0;
+
+    RET_IF_FAIL(start, -EINVAL);
+    RET_IF_FAIL(!(flags & ~MM_REGION_FLAGS), -EINVAL);
+
+    heap = tlsf_create(start, size);
+    if (!heap)
+        return -ENOMEM;
+
+    spinlock_lock(&kmalloc_lock);
+
+    if (nr_regions >= MM_MAX_REGIONS) {
+        retval = -ENOMEM;
+        goto out;
+    }
+
+    region = &regions[nr_regions++];
+    region->name = name;
+    region->start = (uintptr_t) start;
+    region->end = (uintptr_t) start + size;
+    region->flags = flags;
+    region->heap = heap;
+
+out:
+    spinlock_unlock(&kmalloc_lock);
+    return retval;
+}
+
+static unsigned mm_size_bucket(size_t size)
+{
+    unsigned bucket = 0;
+
+    while (size > (MM_MIN_BUCKET_SIZE << bucket) &&
+           bucket < MM_NR_SIZE_BUCKETS - 1)
+        bucket++;
+
+    return bucket;
+}
+
+#ifdef CONFIG_MM_CALLSITES
+/*
+ * The index of the call site in the table is stored in the last word of the
+ * block, past the memory asked for.
+ */
+#define MM_CALLSITE_NONE    UINT32_MAX
+#define MM_TRAILER_SIZE     sizeof(uint32_t)
+
+static uint32_t *mm_trailer(void *ptr)
+{
+    return (uint32_t *) ((char *) ptr + tlsf_block_size(ptr)) - 1;
+}
+
+/**
+ * Must be called with kmalloc_lock held
+ */
+static uint32_t mm_callsite_lookup(void *caller)
+{
+    uint32_t hash = ((uintptr_t) caller >> 1) % MM_NR_CALLSITES;
+
+    for (unsigned i = 0; i < MM_NR_CALLSITES; i++) {
+        struct mm_callsite *site = &callsites[hash];
+
+        if (site->caller == caller)
+            return hash;
+
+        if (!site->caller) {
+            site->caller = caller;
+            return hash;
+        }
+
+        hash = (hash + 1) % MM_NR_CALLSITES;
+    }
+
+    return MM_CALLSITE_NONE;
+}
+
+/**
+ * Must be called with kmalloc_lock held
+ */
+static void mm_track(void *ptr, void *caller)
+{
+    uint32_t index = mm_callsite_lookup(caller);
+
+    *mm_trailer(ptr) = index;
+
+    if (index == MM_CALLSITE_NONE) {
+        mm_stats.untracked_allocs++;
+        return;
+    }
+
+    callsites[index].allocs++;
+    callsites[index].live_blocks++;
+    callsites[index].live_bytes += tlsf_block_size(ptr);
+}
+
+/**
+ * Must be called with kmalloc_lock held
+ */
+static void mm_untrack(void *ptr)
+{
+    uint32_t index = *mm_trailer(ptr);
+
+    if (index >= MM_NR_CALLSITES)
+        return;
+
+    callsites[index].live_blocks--;
+    callsites[index].live_bytes -= tlsf_block_size(ptr);
+}
+
+/**
+ * Undo mm_untrack() on a block that stayed allocated
+ *
+ * Must be called with kmalloc_lock held
+ */
+static void mm_retrack(void *ptr)
+{
+    uint32_t index = *mm_trailer(ptr);
+
+    if (index >= MM_NR_CALLSITES)
+        return;
+
+    callsites[index].live_blocks++;
+    callsites[index].live_bytes += tlsf_block_size(ptr);
+}
+#else
+#define MM_TRAILER_SIZE     0
+
+static inline void mm_track(void *ptr, void *caller) {}
+static inline void mm_untrack(void *ptr) {}
+static inline void mm_retrack(void *ptr) {}
+#endif
+
+static void *__kmalloc(size_t alignment, size_t size, unsigned flags,
+                       void *caller)
+{
+    unsigned required = flags & MM_REGION_FLAGS;
+    void *ptr = NULL;
+
+    spinlock_lock(&kmalloc_lock);
+
+    kmalloc_init_main_heap();
+
+    for (unsigned i = 0; i < nr_regions && !ptr; i++) {
+        if ((regions[i].flags & required) != required)
+            continue;
+
+        ptr = tlsf_memalign(regions[i].heap, alignment,
+                            size + MM_TRAILER_SIZE);
+    }
+
+    mm_stats.allocs++;
+    mm_stats.sizes[mm_size_bucket(size)]++;
+
+    if (ptr)
+        mm_track(ptr, caller);
+    else
+        mm_stats.failures++;
+
+    spinlock_unlock(&kmalloc_lock);
+
+    if (ptr && (flags & MM_ZERO))
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+static void __kfree(void *ptr)
+{
+    struct mm_region *region;
+
+    if (!ptr)
+        return;
+
+    spinlock_lock(&kmalloc_lock);
+
+    region = mm_find_region(ptr);
+    if (region) {
+        mm_untrack(ptr);
+        tlsf_free(region->heap, ptr);
+        mm_stats.frees++;
+    }
+
+    spinlock_unlock(&kmalloc_lock);
+
+    RET_IF_FAIL(region,);
+}
+
+static void *__krealloc(void *ptr, size_t size, void *caller)
+{
+    struct mm_region *region;
+    void *new_ptr = NULL;
+    size_t old_size = 0;
+
+    if (!ptr)
+        return __kmalloc(0, size, 0, caller);
+
+    if (!size) {
+        __kfree(ptr);
+        return NULL;
+    }
+
+    spinlock_lock(&kmalloc_lock);
+
+    region = mm_find_region(ptr);
+    if (region) {
+        old_size = tlsf_block_size(ptr) - MM_TRAILER_SIZE;
+
+        mm_untrack(ptr);
+        new_ptr = tlsf_realloc(region->heap, ptr, size + MM_TRAILER_SIZE);
+        if (new_ptr)
+            mm_track(new_ptr, caller);
+        else
+            mm_retrack(ptr);
+    }
+
+    spinlock_unlock(&kmalloc_lock);
+
+    RET_IF_FAIL(region, NULL);
+
+    if (new_ptr)
+        return new_ptr;
+
+    /* the region is full, move to another one with the same capabilities */
+    new_ptr = __kmalloc(0, size, region->flags, caller);
+    if (!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    __kfree(ptr);
+
+    return new_ptr;
+}
+
+void *kmalloc(size_t size, unsigned flags)
+{
+    return __kmalloc(0, size, flags, __builtin_return_address(0));
+}
+
+void *kmemalign(size_t alignment, size_t size, unsigned flags)
+{
+    return __kmalloc(alignment, size, flags, __builtin_return_address(0));
+}
+
+void *krealloc(void *ptr, size_t size)
+{
+    return __krealloc(ptr, size, __builtin_return_address(0));
+}
+
+void kfree(void *ptr)
+{
+    __kfree(ptr);
+}
+
+/*
+ * newlib allocator replacement
+ *
+ * The libc entry points call the internal functions directly so that the
+ * call sites recorded are the ones of their callers.
+ */
+
+static void *set_errno_if_null(void *ptr)
+{
+    if (!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+static void *__calloc(size_t nmemb, size_t size, void *caller)
+{
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return set_errno_if_null(__kmalloc(0, nmemb * size, MM_ZERO, caller));
+}
+
+static void *__realloc(void *ptr, size_t size, void *caller)
+{
+    void *new_ptr = __krealloc(ptr, size, caller);
+
+    return size ? set_errno_if_null(new_ptr) : new_ptr;
+}
+
+void *malloc(size_t size)
+{
+    return set_errno_if_null(__kmalloc(0, size, 0,
+                                       __builtin_return_address(0)));
+}
+
+void free(void *ptr)
+{
+    __kfree(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    return __calloc(nmemb, size, __builtin_return_address(0));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    return __realloc(ptr, size, __builtin_return_address(0));
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return set_errno_if_null(__kmalloc(alignment, size, 0,
+                                       __builtin_return_address(0)));
+}
+
+void *_malloc_r(struct _reent *reent, size_t size)
+{
+    return set_errno_if_null(__kmalloc(0, size, 0,
+                                       __builtin_return_address(0)));
+}
+
+void _free_r(struct _reent *reent, void *ptr)
+{
+    __kfree(ptr);
+}
+
+void *_calloc_r(struct _reent *reent, size_t nmemb, size_t size)
+{
+    return __calloc(nmemb, size, __builtin_return_address(0));
+}
+
+void *_realloc_r(struct _reent *reent, void *ptr, size_t size)
+{
+    return __realloc(ptr, size, __builtin_return_address(0));
+}
+
+void *_memalign_r(struct _reent *reent, size_t alignment, size_t size)
+{
+    return set_errno_if_null(__kmalloc(alignment, size, 0,
+                                       __builtin_return_address(0)));
+}
+
+static void meminfo_print_regions(void)
+{
+    struct tlsf_stats stats;
+    struct mm_region region;
+
+    printf("%-8s %-9s %8s %8s %8s %8s %8s %6s\n", "region", "flags",
+           "total", "used", "peak", "free", "largest", "blocks");
+
+    for (unsigned i = 0; i < MM_MAX_REGIONS; i++) {
+        spinlock_lock(&kmalloc_lock);
+
+        if (i < nr_regions && regions[i].heap) {
+            memcpy(&region, &regions[i], sizeof(region));
+            tlsf_get_stats(region.heap, &stats);
+        } else {
+            region.heap = NULL;
+        }
+
+        spinlock_unlock(&kmalloc_lock);
+
+        if (!region.heap)
+            continue;
+
+        printf("%-8s %-4s %-4s %8u %8u %8u %8u %8u %6u\n", region.name,
+               region.flags & MM_FAST ? "fast" : "-",
+               region.flags & MM_DMA ? "dma" : "-",
+               stats.total, stats.used, stats.peak, stats.total - stats.used,
+               stats.largest_free, stats.free_blocks);
+    }
+}
+
+static int meminfo_main(int argc, char **argv)
+{
+    struct mm_stats stats;
+
+    meminfo_print_regions();
+
+    spinlock_lock(&kmalloc_lock);
+    memcpy(&stats, &mm_stats, sizeof(stats));
+    spinlock_unlock(&kmalloc_lock);
+
+    printf("\nallocs %lu, frees %lu, failures %lu\n", stats.allocs,
+           stats.frees, stats.failures);
+
+    printf("allocation sizes:\n");
+    for (int i = 0; i < MM_NR_SIZE_BUCKETS; i++) {
+        if (!stats.sizes[i])
+            continue;
+
+        if (i == MM_NR_SIZE_BUCKETS - 1)
+            printf("    > %6u: %lu\n", MM_MIN_BUCKET_SIZE << (i - 1),
+                   stats.sizes[i]);
+        else
+            printf("   <= %6u: %lu\n", MM_MIN_BUCKET_SIZE << i,
+                   stats.sizes[i]);
+    }
+
+#ifdef CONFIG_MM_CALLSITES
+    printf("call sites:\n%10s %8s %8s %8s\n", "caller", "allocs", "live",
+           "bytes");
+
+    for (unsigned i = 0; i < MM_NR_CALLSITES; i++) {
+        struct mm_callsite site;
+
+        spinlock_lock(&kmalloc_lock);
+        memcpy(&site, &callsites[i], sizeof(site));
+        spinlock_unlock(&kmalloc_lock);
+
+        if (site.caller)
+            printf("%10p %8lu %8lu %8lu\n", site.caller, site.allocs,
+                   site.live_blocks, site.live_bytes);
+    }
+
+    if (stats.untracked_allocs)
+        printf("%10s %8lu\n", "others", stats.untracked_allocs);
+#endif
+
+    return 0;
+}
+
+__shell_command__ struct shell_command kmalloc_commands[] = {
+    {"meminfo", "dump the heap usage and statistics", meminfo_main},
+};
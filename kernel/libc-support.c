@@ -6,12 +6,12 @@
  */
 
 #include <stdint.h>
-#include <asm/spinlock.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/stat.h>
 
-static struct spinlock malloc_spinlock = SPINLOCK_INIT(malloc_spinlock);
+#include <phabos/kmalloc.h>
 
 ssize_t low_write(char *buffer, int count);
 int low_getchar(bool wait);
@@ -25,21 +25,16 @@ uint32_t _sbrk(int incr)
     if (!s_heap_end)
         s_heap_end = (uint32_t) &_sheap;
 
+    if (incr > 0 && incr > KERNEL_HEAP_END - s_heap_end) {
+        errno = ENOMEM;
+        return (uint32_t) -1;
+    }
+
     new_heap_space = s_heap_end;
     s_heap_end += incr;
     return new_heap_space;
 }
 
-void __malloc_lock(struct _reent *reent)
-{
-    spinlock_lock(&malloc_spinlock);
-}
-
-void __malloc_unlock(struct _reent *reent)
-{
-    spinlock_unlock(&malloc_spinlock);
-}
-
 int _write(int fd, char *buffer, int count)
 {
     return low_write(buffer, count);
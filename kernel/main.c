@@ -10,12 +10,18 @@
 #include <phabos/kprintf.h>
 #include <phabos/scheduler.h>
 #include <phabos/syscall.h>
+#include <phabos/watchdog.h>
 
 int CONFIG_INIT_TASK_NAME(int argc, char **argv);
 
 #define xstr(s) str(s)
 #define str(s) #s
 
+#ifdef CONFIG_STATIC_KERNEL
+static struct task init_task;
+static uint8_t init_stack[TASK_DEFAULT_STACK_SIZE];
+#endif
+
 void init(void *data)
 {
     char* argv[] = {
@@ -39,5 +45,14 @@ void main(void)
 
     syscall_init();
     scheduler_init();
+
+#ifdef CONFIG_SCHEDULER_WATCHDOG
+    watchdog_timer_task_init();
+#endif
+
+#ifdef CONFIG_STATIC_KERNEL
+    task_run_static(&init_task, init, NULL, init_stack, sizeof(init_stack));
+#else
     task_run(init, NULL, 0);
+#endif
 }
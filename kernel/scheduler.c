@@ -17,34 +17,39 @@
 #include <phabos/utils.h>
 #include <phabos/assert.h>
 #include <phabos/panic.h>
+#include <phabos/workqueue.h>
+#include <phabos/slab.h>
 #include <asm/scheduler.h>
 #include <asm/irq.h>
 #include <asm/atomic.h>
 
 #define TASK_RUNNING                    (1 << 1)
-#define DEFAULT_STACK_SIZE              4096
+#define TASK_STATIC                     (1 << 2)
 
-static struct list_head runqueue = LIST_INIT(runqueue);
+static struct list_head runqueue[NR_TASK_PRIORITIES];
+static struct task idle_task;
 struct task *current;
 bool need_resched;
 static bool kill_task;
 static atomic_t is_locked;
 static int next_task_id;
 
-static struct task *task_create(void)
-{
-    struct task *task;
-
-    task = zalloc(sizeof(*task));
-    RET_IF_FAIL(task, NULL);
+#ifndef CONFIG_STATIC_KERNEL
+static struct kmem_cache task_cache =
+    KMEM_CACHE_INIT(task_cache, "task", sizeof(struct task), NULL);
+#endif
 
+static void task_setup(struct task *task)
+{
     list_init(&task->list);
+    task->priority = TASK_PRIORITY_NORMAL;
 
     irq_disable();
     task->id = next_task_id++;
     irq_enable();
 
-    return task;
+    if (current)
+        task->timer_slack = current->timer_slack;
 }
 
 void task_cond_wait(struct task_cond* cond, struct mutex *mutex)
@@ -68,10 +73,14 @@ void task_cond_broadcast(struct task_cond* cond)
 
 static void task_destroy(struct task *task)
 {
-    // assert
+#ifndef CONFIG_STATIC_KERNEL
+    if (task->state & TASK_STATIC)
+        return;
+
     if (task->allocated_stack)
         free(task->allocated_stack);
-    free(task);
+    kmem_cache_free(&task_cache, task);
+#endif
 }
 
 struct task *task_get_running(void)
@@ -90,6 +99,9 @@ void task_add_to_wait_list(struct task *task, struct list_head *wait_list)
     list_add(wait_list, &task->list);
     task->state &= ~TASK_RUNNING;
 
+    if (task->worker)
+        workqueue_worker_sleeping(task);
+
     irq_enable();
 }
 
@@ -98,39 +110,235 @@ void task_remove_from_wait_list(struct task *task)
     irq_disable();
 
     list_del(&task->list);
-    list_add(&runqueue, &task->list);
+    list_add(&runqueue[task->priority], &task->list);
     task->state |= TASK_RUNNING;
 
+    if (task->worker)
+        workqueue_worker_waking_up(task);
+
+    if (task->priority > current->priority)
+        task_yield();
+
     irq_enable();
 }
 
-struct task *task_run(task_entry_t entry, void *data, uint32_t stack_addr)
+void task_wait(struct list_head *wait_list)
 {
-    struct task *task = task_create();
-    if (!task)
-        return NULL;
+    task_add_to_wait_list(current, wait_list);
+    irq_enable();
+    task_yield();
+    irq_disable();
+}
+
+void task_wake_up_preempt(struct task *task)
+{
+    RET_IF_FAIL(task,);
+
+    irq_disable();
+
+    if (!(task->state & TASK_RUNNING)) {
+        struct list_head *head = &runqueue[task->priority];
+
+        /*
+         * The running task is at the head of its runqueue and gets rotated
+         * out on the next schedule(), so insert the task right after it.
+         */
+        if (head->next == &current->list)
+            head = head->next;
+
+        list_del(&task->list);
+        list_add(head->next, &task->list);
+        task->state |= TASK_RUNNING;
+
+        if (task->worker)
+            workqueue_worker_waking_up(task);
+
+        task_yield();
+    }
+
+    irq_enable();
+}
+
+static void task_timeout_expired(struct watchdog *wd)
+{
+    struct task_timeout *timeout = wd->user_priv;
+
+    RET_IF_FAIL(timeout,);
+
+    irq_disable();
+
+    timeout->expired = true;
+    if (!(timeout->task->state & TASK_RUNNING))
+        task_remove_from_wait_list(timeout->task);
+
+    irq_enable();
+}
+
+void task_timeout_start(struct task_timeout *timeout, unsigned long usec)
+{
+    RET_IF_FAIL(timeout,);
+
+    timeout->task = current;
+    timeout->expired = false;
+
+    watchdog_init(&timeout->watchdog);
+    timeout->watchdog.timeout = task_timeout_expired;
+    timeout->watchdog.user_priv = timeout;
+    watchdog_start(&timeout->watchdog, usec);
+}
+
+void task_timeout_stop(struct task_timeout *timeout)
+{
+    RET_IF_FAIL(timeout,);
+
+    watchdog_delete(&timeout->watchdog);
+}
+
+void task_notify(struct task *task, uint32_t bits,
+                 enum task_notify_action action)
+{
+    RET_IF_FAIL(task,);
+
+    irq_disable();
+
+    switch (action) {
+    case TASK_NOTIFY_SET_BITS:
+        task->notify_value |= bits;
+        break;
+
+    case TASK_NOTIFY_INCREMENT:
+        task->notify_value++;
+        break;
+
+    case TASK_NOTIFY_OVERWRITE:
+        task->notify_value = bits;
+        break;
+    }
+
+    if (task->notify_value & task->notify_mask) {
+        task->notify_mask = 0;
+        task_remove_from_wait_list(task);
+    }
+
+    irq_enable();
+}
+
+uint32_t task_notify_wait(uint32_t mask, unsigned long timeout)
+{
+    struct list_head wait_list;
+    struct task_timeout task_timeout;
+    uint32_t value;
+
+    RET_IF_FAIL(mask, 0);
+
+    list_init(&wait_list);
+
+    if (timeout)
+        task_timeout_start(&task_timeout, timeout);
+
+    irq_disable();
+
+    while (!(current->notify_value & mask)) {
+        if (timeout && task_timeout.expired)
+            break;
+
+        current->notify_mask = mask;
+        task_wait(&wait_list);
+        current->notify_mask = 0;
+    }
+
+    value = current->notify_value & mask;
+    current->notify_value &= ~mask;
+
+    irq_enable();
+
+    if (timeout)
+        task_timeout_stop(&task_timeout);
+
+    return value;
+}
+
+void task_start(struct task *task)
+{
+    RET_IF_FAIL(task,);
+    RET_IF_FAIL(!(task->state & TASK_RUNNING),);
+
+    irq_disable();
+    list_add(&runqueue[task->priority], &task->list);
+    task->state |= TASK_RUNNING;
+    irq_enable();
+}
+
+#ifndef CONFIG_STATIC_KERNEL
+struct task *task_create(task_entry_t entry, void *data, uint32_t stack_addr)
+{
+    struct task *task;
+
+    task = kmem_cache_alloc(&task_cache, MM_ZERO);
+    RET_IF_FAIL(task, NULL);
+
+    task_setup(task);
 
     if (!stack_addr) {
-        task->allocated_stack = malloc(DEFAULT_STACK_SIZE);
+        task->allocated_stack = malloc(TASK_DEFAULT_STACK_SIZE);
         if (!task->allocated_stack)
             goto error_stack;
 
-        stack_addr = (uint32_t) task->allocated_stack + DEFAULT_STACK_SIZE;
+        stack_addr = (uint32_t) task->allocated_stack +
+                     TASK_DEFAULT_STACK_SIZE;
     }
 
     task_init_registers(task, entry, data, stack_addr);
-    task->state = TASK_RUNNING;
-
-    irq_disable();
-    list_add(&runqueue, &task->list);
-    irq_enable();
 
     return task;
 error_stack:
-    free(task);
+    kmem_cache_free(&task_cache, task);
     return NULL;
 }
 
+struct task *task_run(task_entry_t entry, void *data, uint32_t stack_addr)
+{
+    struct task *task = task_create(entry, data, stack_addr);
+
+    if (task)
+        task_start(task);
+
+    return task;
+}
+#endif
+
+struct task *task_init(struct task *task, task_entry_t entry, void *data,
+                       void *stack, size_t stack_size)
+{
+    uint32_t stack_addr;
+
+    RET_IF_FAIL(task, NULL);
+    RET_IF_FAIL(stack, NULL);
+    RET_IF_FAIL(stack_size, NULL);
+
+    memset(task, 0, sizeof(*task));
+    task_setup(task);
+    task->state = TASK_STATIC;
+
+    /* the AAPCS wants the stack to be 8-byte aligned */
+    stack_addr = ((uint32_t) stack + stack_size) & ~7;
+
+    task_init_registers(task, entry, data, stack_addr);
+
+    return task;
+}
+
+struct task *task_run_static(struct task *task, task_entry_t entry, void *data,
+                             void *stack, size_t stack_size)
+{
+    if (!task_init(task, entry, data, stack, stack_size))
+        return NULL;
+
+    task_start(task);
+
+    return task;
+}
+
 void task_kill(struct task *task)
 {
     if (task->id == 0) {
@@ -152,6 +360,38 @@ void task_kill(struct task *task)
     irq_enable();
 }
 
+void task_set_timer_slack(struct task *task, unsigned long usec)
+{
+    RET_IF_FAIL(task,);
+    task->timer_slack = usec;
+}
+
+int task_set_priority(struct task *task, unsigned priority)
+{
+    RET_IF_FAIL(task, -EINVAL);
+    RET_IF_FAIL(priority < NR_TASK_PRIORITIES, -EINVAL);
+    RET_IF_FAIL(task->id != 0, -EINVAL);
+    RET_IF_FAIL(priority != TASK_PRIORITY_IDLE, -EINVAL);
+
+    irq_disable();
+
+    if (task->state & TASK_RUNNING) {
+        list_del(&task->list);
+        list_add(&runqueue[priority], &task->list);
+    }
+
+    task->priority = priority;
+
+    /* tasks not started yet are only given their priority */
+    if (task == current ||
+        ((task->state & TASK_RUNNING) && priority > current->priority))
+        task_yield();
+
+    irq_enable();
+
+    return 0;
+}
+
 void task_exit(void)
 {
     kill_task = true;
@@ -160,15 +400,19 @@ void task_exit(void)
 
 void scheduler_init(void)
 {
-    struct task *task;
+    struct task *task = &idle_task;
 
-    task = task_create();
-    if (!task)
-        panic("scheduler: cannot allocate memory.\n");
+    /* the idle task keeps running on the boot stack */
+    task_setup(task);
+    task->state = TASK_STATIC;
 
-    task->state = TASK_RUNNING;
+    for (int i = 0; i < NR_TASK_PRIORITIES; i++)
+        list_init(&runqueue[i]);
+
+    task->state |= TASK_RUNNING;
+    task->priority = TASK_PRIORITY_IDLE;
 
-    list_add(&runqueue, &task->list);
+    list_add(&runqueue[task->priority], &task->list);
 
     atomic_init(&is_locked, 0);
 
@@ -178,20 +422,40 @@ void scheduler_init(void)
     scheduler_arch_init();
 }
 
-void schedule(uint32_t *stack_top)
+/**
+ * Returns the first task of the highest priority non-empty runqueue
+ */
+static struct task *pick_next_task(void)
+{
+    for (int i = NR_TASK_PRIORITIES - 1; i >= 0; i--) {
+        if (!list_is_empty(&runqueue[i]))
+            return list_first_entry(&runqueue[i], struct task, list);
+    }
+
+    return NULL;
+}
+
+bool schedule(uint32_t *stack_top)
 {
     struct task *current_saved = current;
+    struct list_head *head = &runqueue[current->priority];
+    struct task *next;
 
+    /* need_resched stays set, sched_unlock() calls us again */
     if (atomic_get(&is_locked))
-        return;
-
-    if (list_is_empty(&runqueue))
-        panic("scheduler: no idle task to run\n");
+        return false;
 
     memcpy(&current->registers, stack_top, sizeof(current->registers));
 
-    list_rotate_anticlockwise(&runqueue);
-    current = list_first_entry(&runqueue, struct task, list);
+    /* round-robin between the tasks of the same priority */
+    if (head->next == &current->list)
+        list_rotate_anticlockwise(head);
+
+    next = pick_next_task();
+    if (!next)
+        panic("scheduler: no idle task to run\n");
+
+    current = next;
     need_resched = false;
 
     memcpy((void*) (current->registers[SP_REG] - 4),
@@ -201,6 +465,8 @@ void schedule(uint32_t *stack_top)
         kill_task = false;
         task_kill(current_saved);
     }
+
+    return true;
 }
 
 void sched_lock(void)
@@ -210,7 +476,8 @@ void sched_lock(void)
 
 void sched_unlock(void)
 {
-    atomic_dec(&is_locked);
+    if (!atomic_dec(&is_locked) && need_resched)
+        task_yield();
 }
 
 static struct task *find_task_by_id(int id)
@@ -218,14 +485,19 @@ static struct task *find_task_by_id(int id)
     struct task *task;
 
     irq_disable();
-    list_foreach(&runqueue, iter) {
-        task = list_entry(iter, struct task, list);
-        if (id == task->id)
-            break;
-        task = NULL;
+
+    for (int i = 0; i < NR_TASK_PRIORITIES; i++) {
+        list_foreach(&runqueue[i], iter) {
+            task = list_entry(iter, struct task, list);
+            if (id == task->id)
+                goto out;
+        }
     }
-    irq_enable();
 
+    task = NULL;
+
+out:
+    irq_enable();
     return task;
 }
 
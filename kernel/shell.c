@@ -10,8 +10,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <config.h>
 #include <phabos/shell.h>
 #include <phabos/list.h>
+#include <phabos/slab.h>
 
 #define BOLD_TEXT_ESCAPE "\033[1m"
 #define NORMAL_TEXT_ESCAPE "\033[0m"
@@ -20,16 +22,30 @@ static const char *const SHELL_PROMPT = BOLD_TEXT_ESCAPE "phabos> "
                                         NORMAL_TEXT_ESCAPE;
 #define COMMAND_LINE_MAX_SIZE   4096
 #define ARGV_MAX_SIZE           32
+#define HISTORY_SIZE            10
+#define HISTORY_LINE_MAX_SIZE   128
 
 static char buffer[COMMAND_LINE_MAX_SIZE];
 static size_t history_cmd_count;
-static const size_t history_size = 10;
 static struct list_head history = LIST_INIT(history);
 static struct list_head *history_iter;
+
+#ifdef CONFIG_STATIC_KERNEL
+/* an entry is free when its command is empty */
+struct shell_history_command {
+    char command[HISTORY_LINE_MAX_SIZE];
+    struct list_head list;
+};
+static struct shell_history_command history_entries[HISTORY_SIZE];
+#else
 struct shell_history_command {
     char *command;
     struct list_head list;
 };
+static struct kmem_cache history_cache =
+    KMEM_CACHE_INIT(history_cache, "shell_history",
+                    sizeof(struct shell_history_command), NULL);
+#endif
 
 static int hello_main(int argc, char **argv);
 static int help_main(int argc, char **argv);
@@ -67,25 +83,75 @@ static struct shell_history_command* shell_history_prev()
     return list_entry(history_iter, struct shell_history_command, list);
 }
 
-static void shell_history_add(char *command)
+#ifdef CONFIG_STATIC_KERNEL
+/**
+ * Empty commands and the ones too long for an entry are not recorded
+ */
+static struct shell_history_command *shell_history_alloc(const char *command)
+{
+    size_t len = strlen(command);
+
+    if (!len || len >= HISTORY_LINE_MAX_SIZE)
+        return NULL;
+
+    for (int i = 0; i < HISTORY_SIZE; i++) {
+        if (!history_entries[i].command[0]) {
+            strcpy(history_entries[i].command, command);
+            return &history_entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void shell_history_free(struct shell_history_command *cmd)
+{
+    cmd->command[0] = '\0';
+}
+#else
+static struct shell_history_command *shell_history_alloc(const char *command)
 {
     struct shell_history_command *cmd;
 
-    if (!history_size)
-        return;
+    cmd = kmem_cache_alloc(&history_cache, 0);
+    if (!cmd)
+        return NULL;
 
-    if (history_cmd_count >= history_size) {
+    cmd->command = malloc(strlen(command) + 1);
+    if (!cmd->command) {
+        kmem_cache_free(&history_cache, cmd);
+        return NULL;
+    }
+
+    strcpy(cmd->command, command);
+    return cmd;
+}
+
+static void shell_history_free(struct shell_history_command *cmd)
+{
+    free(cmd->command);
+    kmem_cache_free(&history_cache, cmd);
+}
+#endif
+
+static void shell_history_add(char *command)
+{
+    struct shell_history_command *cmd;
+
+    if (history_cmd_count >= HISTORY_SIZE) {
         cmd = list_last_entry(&history, struct shell_history_command, list);
-        free(cmd->command);
         list_del(&cmd->list);
-        free(cmd);
+        shell_history_free(cmd);
+        history_cmd_count--;
     }
 
-    cmd = malloc(sizeof(*cmd));
+    cmd = shell_history_alloc(command);
+    if (!cmd)
+        return;
+
     list_init(&cmd->list);
-    cmd->command = malloc(strlen(command) + 1);
-    strcpy(cmd->command, command);
     list_add(&history, &cmd->list);
+    history_cmd_count++;
 }
 
 static size_t shell_get_command_count(void)
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <phabos/slab.h>
+#include <phabos/shell.h>
+#include <phabos/assert.h>
+#include <asm/spinlock.h>
+
+#define KMEM_SLAB_SIZE          512
+#define KMEM_DEFAULT_ALIGN      8
+
+#define KMEM_CACHE_ALLOCATED    (1 << 0)
+
+struct kmem_slab {
+    struct kmem_slab *next;
+};
+
+static struct spinlock slab_lock = SPINLOCK_INIT(slab_lock);
+static struct list_head caches = LIST_INIT(caches);
+
+static inline size_t align_up(size_t x, size_t align)
+{
+    return (x + align - 1) & ~(align - 1);
+}
+
+static inline void **free_pointer(struct kmem_cache *cache, void *object)
+{
+    return (void **) ((char *) object + cache->free_offset);
+}
+
+/**
+ * Compute the layout of the objects and register the cache
+ *
+ * Must be called with slab_lock held
+ */
+static void kmem_cache_setup(struct kmem_cache *cache)
+{
+    size_t header;
+
+    if (cache->size)
+        return;
+
+    if (!cache->align)
+        cache->align = KMEM_DEFAULT_ALIGN;
+
+    /* keep the constructed state intact while the object is free */
+    if (cache->ctor)
+        cache->free_offset = align_up(cache->object_size, sizeof(void *));
+
+    cache->size = align_up(cache->free_offset + sizeof(void *), cache->align);
+    if (cache->size < cache->object_size)
+        cache->size = align_up(cache->object_size, cache->align);
+
+    header = align_up(sizeof(struct kmem_slab), cache->align);
+    cache->objects_per_slab = (KMEM_SLAB_SIZE - header) / cache->size;
+    if (!cache->objects_per_slab)
+        cache->objects_per_slab = 1;
+
+    list_add(&caches, &cache->list);
+}
+
+/**
+ * Push a chain of objects linked through their free pointer
+ */
+static void kmem_cache_push(struct kmem_cache *cache, void *first, void *last)
+{
+    void *head;
+
+    /*
+     * The link is written before the exclusive load: a store between
+     * LDREX and STREX may clear the monitor on some implementations and
+     * keep the sequence from ever succeeding.
+     */
+    while (1) {
+        head = *(void * volatile *) &cache->free_list;
+        *free_pointer(cache, last) = head;
+
+        dmb();
+
+        if ((void *) load_exclusive(&cache->free_list) != head) {
+            clear_exclusive();
+            continue;
+        }
+
+        if (!store_exclusive(&cache->free_list, (uint32_t) first))
+            break;
+    }
+}
+
+static void *kmem_cache_pop(struct kmem_cache *cache)
+{
+    void *object;
+    void *next;
+
+    /*
+     * Any interrupt between the load and the store makes the store fail, so
+     * the object can't have been popped and pushed back meanwhile.
+     */
+    do {
+        object = (void *) load_exclusive(&cache->free_list);
+        if (!object) {
+            clear_exclusive();
+            return NULL;
+        }
+
+        next = *free_pointer(cache, object);
+    } while (store_exclusive(&cache->free_list, (uint32_t) next));
+
+    dmb();
+
+    return object;
+}
+
+static int kmem_cache_grow(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab;
+    char *first;
+    char *last;
+    size_t header;
+
+    spinlock_lock(&slab_lock);
+    kmem_cache_setup(cache);
+    spinlock_unlock(&slab_lock);
+
+    header = align_up(sizeof(*slab), cache->align);
+
+    slab = kmemalign(cache->align, header +
+                     cache->objects_per_slab * cache->size, 0);
+    if (!slab)
+        return -ENOMEM;
+
+    first = (char *) slab + header;
+    last = first + (cache->objects_per_slab - 1) * cache->size;
+
+    for (unsigned i = 0; i < cache->objects_per_slab; i++) {
+        char *object = first + i * cache->size;
+
+        if (cache->ctor)
+            cache->ctor(object);
+
+        *free_pointer(cache, object) = object + cache->size;
+    }
+
+    spinlock_lock(&slab_lock);
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+    spinlock_unlock(&slab_lock);
+
+    atomic_inc(&cache->nr_slabs);
+    atomic_add(&cache->nr_objects, cache->objects_per_slab);
+
+    kmem_cache_push(cache, first, last);
+
+    return 0;
+}
+
+void kmem_cache_init(struct kmem_cache *cache, const char *name, size_t size,
+                     size_t align, void (*ctor)(void *object))
+{
+    RET_IF_FAIL(cache,);
+    RET_IF_FAIL(size,);
+    RET_IF_FAIL(!(align & (align - 1)),);
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    list_init(&cache->list);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, void (*ctor)(void *object))
+{
+    struct kmem_cache *cache;
+
+    cache = kmalloc(sizeof(*cache), 0);
+    RET_IF_FAIL(cache, NULL);
+
+    kmem_cache_init(cache, name, size, align, ctor);
+    cache->flags |= KMEM_CACHE_ALLOCATED;
+
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab;
+
+    if (!cache)
+        return;
+
+    RET_IF_FAIL(!atomic_get(&cache->nr_active),);
+
+    spinlock_lock(&slab_lock);
+    if (cache->size)
+        list_del(&cache->list);
+    slab = cache->slabs;
+    cache->slabs = NULL;
+    cache->free_list = NULL;
+    spinlock_unlock(&slab_lock);
+
+    while (slab) {
+        struct kmem_slab *next = slab->next;
+        kfree(slab);
+        slab = next;
+    }
+
+    if (cache->flags & KMEM_CACHE_ALLOCATED)
+        kfree(cache);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache, unsigned flags)
+{
+    void *object;
+
+    RET_IF_FAIL(cache, NULL);
+    RET_IF_FAIL(!(flags & MM_ZERO) || !cache->ctor, NULL);
+
+    while (!(object = kmem_cache_pop(cache))) {
+        if (kmem_cache_grow(cache))
+            return NULL;
+    }
+
+    atomic_inc(&cache->nr_active);
+    atomic_inc(&cache->nr_allocs);
+
+    if (flags & MM_ZERO)
+        memset(object, 0, cache->object_size);
+
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object)
+{
+    RET_IF_FAIL(cache,);
+
+    if (!object)
+        return;
+
+    atomic_dec(&cache->nr_active);
+    kmem_cache_push(cache, object, object);
+}
+
+static int slabinfo_main(int argc, char **argv)
+{
+    struct kmem_cache *cache;
+    unsigned i = 0;
+
+    printf("%-16s %8s %8s %8s %8s %8s\n", "name", "objsize", "active",
+           "total", "slabs", "allocs");
+
+    /* don't print with the interrupts disabled, copy the caches one by one */
+    while (1) {
+        struct kmem_cache snapshot;
+        unsigned n = i++;
+
+        cache = NULL;
+
+        spinlock_lock(&slab_lock);
+        list_foreach(&caches, iter) {
+            if (!n--) {
+                cache = list_entry(iter, struct kmem_cache, list);
+                memcpy(&snapshot, cache, sizeof(snapshot));
+                break;
+            }
+        }
+        spinlock_unlock(&slab_lock);
+
+        if (!cache)
+            break;
+
+        printf("%-16s %8u %8u %8u %8u %8u\n", snapshot.name,
+               snapshot.object_size, snapshot.nr_active, snapshot.nr_objects,
+               snapshot.nr_slabs, snapshot.nr_allocs);
+    }
+
+    return 0;
+}
+
+__shell_command__ struct shell_command slab_commands[] = {
+    {"slabinfo", "dump the object caches statistics", slabinfo_main},
+};
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stddef.h>
+
+#include <phabos/softirq.h>
+#include <phabos/assert.h>
+#include <asm/atomic.h>
+
+static atomic_t softirq_pending;
+static softirq_handler_t softirq_handlers[NR_SOFTIRQS];
+
+void softirq_register(enum softirq nr, softirq_handler_t handler)
+{
+    RET_IF_FAIL(nr < NR_SOFTIRQS,);
+    softirq_handlers[nr] = handler;
+}
+
+void softirq_raise(enum softirq nr)
+{
+    RET_IF_FAIL(nr < NR_SOFTIRQS,);
+
+    atomic_fetch_or(&softirq_pending, 1 << nr);
+    softirq_arch_raise();
+}
+
+void softirq_run(void)
+{
+    uint32_t pending;
+
+    while ((pending = atomic_xchg(&softirq_pending, 0))) {
+        for (int i = 0; i < NR_SOFTIRQS; i++) {
+            if ((pending & (1 << i)) && softirq_handlers[i])
+                softirq_handlers[i]();
+        }
+    }
+}
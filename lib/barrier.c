@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <phabos/barrier.h>
+#include <phabos/scheduler.h>
+#include <phabos/assert.h>
+#include <asm/irq.h>
+
+void task_barrier_init(struct task_barrier *barrier, unsigned count)
+{
+    RET_IF_FAIL(barrier,);
+    RET_IF_FAIL(count,);
+
+    list_init(&barrier->wait_list);
+    barrier->count = count;
+    barrier->waiting = 0;
+    barrier->generation = 0;
+}
+
+bool task_barrier_wait(struct task_barrier *barrier)
+{
+    unsigned generation;
+
+    RET_IF_FAIL(barrier, false);
+
+    irq_disable();
+
+    generation = barrier->generation;
+
+    if (++barrier->waiting >= barrier->count) {
+        barrier->waiting = 0;
+        barrier->generation++;
+
+        list_foreach_safe(&barrier->wait_list, iter)
+            task_remove_from_wait_list(list_entry(iter, struct task, list));
+
+        irq_enable();
+        return true;
+    }
+
+    while (generation == barrier->generation)
+        task_wait(&barrier->wait_list);
+
+    irq_enable();
+    return false;
+}
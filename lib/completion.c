@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <limits.h>
+
+#include <phabos/completion.h>
+#include <phabos/scheduler.h>
+#include <phabos/assert.h>
+#include <asm/irq.h>
+
+#define COMPLETION_DONE_ALL UINT_MAX
+
+void completion_init(struct completion *completion)
+{
+    RET_IF_FAIL(completion,);
+
+    list_init(&completion->wait_list);
+    completion->done = 0;
+}
+
+void completion_reinit(struct completion *completion)
+{
+    RET_IF_FAIL(completion,);
+
+    irq_disable();
+    completion->done = 0;
+    irq_enable();
+}
+
+static int do_wait_for_completion(struct completion *completion,
+                                  struct task_timeout *timeout)
+{
+    int retval = 0;
+
+    irq_disable();
+
+    while (!completion->done) {
+        if (timeout && timeout->expired) {
+            retval = -ETIMEDOUT;
+            goto out;
+        }
+
+        task_wait(&completion->wait_list);
+    }
+
+    if (completion->done != COMPLETION_DONE_ALL)
+        completion->done--;
+
+out:
+    irq_enable();
+    return retval;
+}
+
+void wait_for_completion(struct completion *completion)
+{
+    RET_IF_FAIL(completion,);
+
+    do_wait_for_completion(completion, NULL);
+}
+
+int wait_for_completion_timeout(struct completion *completion,
+                                unsigned long timeout)
+{
+    struct task_timeout task_timeout;
+    int retval;
+
+    RET_IF_FAIL(completion, -EINVAL);
+    RET_IF_FAIL(timeout, -EINVAL);
+
+    task_timeout_start(&task_timeout, timeout);
+    retval = do_wait_for_completion(completion, &task_timeout);
+    task_timeout_stop(&task_timeout);
+
+    return retval;
+}
+
+void complete(struct completion *completion)
+{
+    RET_IF_FAIL(completion,);
+
+    irq_disable();
+
+    if (completion->done != COMPLETION_DONE_ALL)
+        completion->done++;
+
+    if (!list_is_empty(&completion->wait_list))
+        task_remove_from_wait_list(list_first_entry(&completion->wait_list,
+                                                    struct task, list));
+
+    irq_enable();
+}
+
+void complete_all(struct completion *completion)
+{
+    RET_IF_FAIL(completion,);
+
+    irq_disable();
+
+    completion->done = COMPLETION_DONE_ALL;
+
+    list_foreach_safe(&completion->wait_list, iter)
+        task_remove_from_wait_list(list_entry(iter, struct task, list));
+
+    irq_enable();
+}
+
+bool completion_done(struct completion *completion)
+{
+    RET_IF_FAIL(completion, false);
+    return completion->done != 0;
+}
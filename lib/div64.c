@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stddef.h>
+#include <phabos/div64.h>
+
+/*
+ * Long division in base 2^32: the upper word is divided with the hardware
+ * 32-bit divider, then the partial remainder is carried through the lower
+ * word one bit at a time. The partial remainder is always smaller than the
+ * divisor, so it fits in 32 bits plus the bit shifted out at each step.
+ */
+uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t *remainder)
+{
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend;
+    uint32_t quot_high = high / divisor;
+    uint32_t quot_low = 0;
+    uint32_t rem = high % divisor;
+
+    for (int i = 31; i >= 0; i--) {
+        uint32_t overflow = rem >> 31;
+
+        rem = (rem << 1) | ((low >> i) & 1);
+        quot_low <<= 1;
+
+        if (overflow || rem >= divisor) {
+            rem -= divisor;
+            quot_low |= 1;
+        }
+    }
+
+    if (remainder)
+        *remainder = rem;
+    return ((uint64_t) quot_high << 32) | quot_low;
+}
@@ -12,13 +12,19 @@
 #include <phabos/list.h>
 #include <phabos/scheduler.h>
 #include <phabos/assert.h>
+#include <phabos/slab.h>
 #include <asm/irq.h>
 
+#ifndef CONFIG_STATIC_KERNEL
+static struct kmem_cache semaphore_cache =
+    KMEM_CACHE_INIT(semaphore_cache, "semaphore", sizeof(struct semaphore),
+                    NULL);
+
 struct semaphore *semaphore_create(unsigned val)
 {
     struct semaphore *semaphore;
 
-    semaphore = malloc(sizeof(*semaphore));
+    semaphore = kmem_cache_alloc(&semaphore_cache, 0);
     if (!semaphore)
         return NULL;
     semaphore_init(semaphore, val);
@@ -26,6 +32,16 @@ struct semaphore *semaphore_create(unsigned val)
     return semaphore;
 }
 
+void semaphore_destroy(struct semaphore *semaphore)
+{
+    if (!semaphore)
+        return;
+
+    RET_IF_FAIL(list_is_empty(&semaphore->wait_list),);
+    kmem_cache_free(&semaphore_cache, semaphore);
+}
+#endif
+
 void semaphore_init(struct semaphore *semaphore, unsigned val)
 {
     RET_IF_FAIL(semaphore,);
@@ -35,15 +51,6 @@ void semaphore_init(struct semaphore *semaphore, unsigned val)
     atomic_init(&semaphore->count, val);
 }
 
-void semaphore_destroy(struct semaphore *semaphore)
-{
-    if (!semaphore)
-        return;
-
-    RET_IF_FAIL(list_is_empty(&semaphore->wait_list),);
-    free(semaphore);
-}
-
 void semaphore_lock(struct semaphore *semaphore)
 {
     RET_IF_FAIL(semaphore,);
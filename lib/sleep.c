@@ -5,36 +5,111 @@
  * Provided under the three clause BSD license found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <stdbool.h>
+
 #include <phabos/list.h>
 #include <phabos/sleep.h>
-#include <phabos/semaphore.h>
-#include <phabos/watchdog.h>
+#include <phabos/scheduler.h>
+#include <phabos/hrtimer.h>
+#include <phabos/time.h>
 #include <phabos/assert.h>
+#include <asm/irq.h>
 
 extern struct task *current;
 
-static void usleep_timeout(struct watchdog *watchdog)
+struct sleeper {
+    struct hrtimer timer;
+    struct task *task;
+    bool expired;
+};
+
+static void sleeper_timeout(struct hrtimer *timer)
 {
-    RET_IF_FAIL(watchdog,);
-    RET_IF_FAIL(watchdog->user_priv,);
+    struct sleeper *sleeper = timer->user_priv;
 
-    semaphore_unlock(watchdog->user_priv);
+    RET_IF_FAIL(sleeper,);
+
+    irq_disable();
+    sleeper->expired = true;
+    task_wake_up_preempt(sleeper->task);
+    irq_enable();
 }
 
-int usleep(useconds_t usec)
+/**
+ * Sleep until the monotonic clock reaches expires
+ */
+static void sleep_until(ktime_t expires)
+{
+    struct list_head wait_list;
+    struct sleeper sleeper;
+
+    list_init(&wait_list);
+
+    hrtimer_init(&sleeper.timer);
+    sleeper.timer.function = sleeper_timeout;
+    sleeper.timer.user_priv = &sleeper;
+    sleeper.timer.slack = ktime_from_usec(current->timer_slack);
+    sleeper.task = current;
+    sleeper.expired = false;
+
+    irq_disable();
+
+    hrtimer_start(&sleeper.timer, expires, HRTIMER_MODE_ABS);
+    while (!sleeper.expired)
+        task_wait(&wait_list);
+
+    irq_enable();
+}
+
+int clock_nanosleep(clockid_t clock_id, int flags,
+                    const struct timespec *req, struct timespec *rem)
 {
-    struct semaphore semaphore;
-    struct watchdog watchdog;
+    ktime_t expires;
+
+    RET_IF_FAIL(req, -EINVAL);
+
+    if (clock_id != CLOCK_MONOTONIC && clock_id != CLOCK_MONOTONIC_RAW)
+        return -EINVAL;
+
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= NSEC_PER_SEC)
+        return -EINVAL;
 
-    semaphore_init(&semaphore, 0);
+    expires = timespec_to_ktime(req);
+    if (!(flags & TIMER_ABSTIME))
+        expires += ktime_get();
 
-    watchdog_init(&watchdog);
-    watchdog.timeout = usleep_timeout;
-    watchdog.user_priv = &semaphore;
+    sleep_until(expires);
 
-    watchdog_start(&watchdog, usec);
-    semaphore_lock(&semaphore);
-    watchdog_delete(&watchdog);
+    if (rem && !(flags & TIMER_ABSTIME)) {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
 
     return 0;
 }
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    return clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+}
+
+int task_delay_until(ktime_t *last_wake, ktime_t period)
+{
+    RET_IF_FAIL(last_wake, -EINVAL);
+    RET_IF_FAIL(period, -EINVAL);
+
+    *last_wake += period;
+
+    if (*last_wake <= ktime_get())
+        return -ETIMEDOUT;
+
+    sleep_until(*last_wake);
+    return 0;
+}
+
+int usleep(useconds_t usec)
+{
+    sleep_until(ktime_get() + ktime_from_usec(usec));
+    return 0;
+}
@@ -6,30 +6,48 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <time.h>
 
 #include <phabos/time.h>
+#include <phabos/ktime.h>
+#include <phabos/clocksource.h>
 #include <phabos/assert.h>
-#include <asm/scheduler.h>
-#include <asm/machine.h>
 
-static int clock_monotonic_gettime(struct timespec *tp)
+/*
+ * The monotonic clock is never slewed, so CLOCK_MONOTONIC and
+ * CLOCK_MONOTONIC_RAW follow the same timeline.
+ */
+static bool clock_is_supported(clockid_t clk_id)
 {
-    uint32_t ticks = get_ticks(); // FIXME uint64_t
+    return clk_id == CLOCK_MONOTONIC || clk_id == CLOCK_MONOTONIC_RAW;
+}
 
+int clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
     RET_IF_FAIL(tp, -EINVAL);
 
-    tp->tv_sec = ticks / HZ;
-    tp->tv_nsec = ticks % HZ;
+    if (!clock_is_supported(clk_id))
+        return -EINVAL;
 
+    *tp = ktime_to_timespec(ktime_get());
     return 0;
 }
 
-int clock_gettime(clockid_t clk_id, struct timespec *tp)
+int clock_getres(clockid_t clk_id, struct timespec *res)
 {
-    RET_IF_FAIL(tp, -EINVAL);
+    struct clocksource *cs = clocksource_get();
+
+    if (!clock_is_supported(clk_id))
+        return -EINVAL;
+
+    if (!res)
+        return 0;
 
-    if (clk_id == CLOCK_MONOTONIC)
-        return clock_monotonic_gettime(tp);
-    return -EINVAL;
+    res->tv_sec = 0;
+    res->tv_nsec = cs ? ktime_cycles_to_ns(1) : 0;
+    if (!res->tv_nsec)
+        res->tv_nsec = 1;
+
+    return 0;
 }
@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2015 Fabien Parent. All rights reserved.
+ * Author: Fabien Parent <parent.f@gmail.com>
+ *
+ * Provided under the three clause BSD license found in the LICENSE file.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <phabos/tlsf.h>
+#include <phabos/assert.h>
+
+#define TLSF_ALIGN_LOG2         3
+#define TLSF_ALIGN              (1 << TLSF_ALIGN_LOG2)
+
+#define SL_INDEX_COUNT_LOG2     4
+#define SL_INDEX_COUNT          (1 << SL_INDEX_COUNT_LOG2)
+
+/* blocks below SMALL_BLOCK_SIZE all live in the first level 0 */
+#define FL_INDEX_MAX            20
+#define FL_INDEX_SHIFT          (SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_LOG2)
+#define FL_INDEX_COUNT          (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE        (1 << FL_INDEX_SHIFT)
+
+#define BLOCK_FREE              (1 << 0)
+#define BLOCK_FLAGS_MASK        (TLSF_ALIGN - 1)
+
+/**
+ * prev_phys: block right before this one in memory, NULL for the first one
+ * size: payload size, the low bits are used for the flags
+ * next_free, prev_free: free list links, overlap the payload
+ */
+struct tlsf_block {
+    struct tlsf_block *prev_phys;
+    size_t size;
+
+    struct tlsf_block *next_free;
+    struct tlsf_block *prev_free;
+};
+
+#define BLOCK_HEADER_SIZE       offsetof(struct tlsf_block, next_free)
+#define BLOCK_SIZE_MIN          (sizeof(struct tlsf_block) - BLOCK_HEADER_SIZE)
+#define BLOCK_SIZE_MAX          ((size_t) 1 << FL_INDEX_MAX)
+
+/**
+ * null_block: terminates the free lists so that they are never NULL
+ * fl_bitmap: first levels having at least one free block
+ * sl_bitmap: second levels having at least one free block, per first level
+ * used, peak: bytes in allocated blocks, headers included
+ */
+struct tlsf {
+    struct tlsf_block null_block;
+
+    size_t total;
+    size_t used;
+    size_t peak;
+
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[FL_INDEX_COUNT];
+    struct tlsf_block *blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+};
+
+static inline int tlsf_fls(size_t x)
+{
+    return 31 - __builtin_clz(x);
+}
+
+static inline int tlsf_ffs(uint32_t x)
+{
+    return __builtin_ctz(x);
+}
+
+static inline uintptr_t align_up(uintptr_t x, size_t align)
+{
+    return (x + align - 1) & ~(align - 1);
+}
+
+static inline uintptr_t align_down(uintptr_t x, size_t align)
+{
+    return x & ~(align - 1);
+}
+
+static inline size_t block_size(struct tlsf_block *block)
+{
+    return block->size & ~BLOCK_FLAGS_MASK;
+}
+
+static inline void block_set_size(struct tlsf_block *block, size_t size)
+{
+    block->size = size | (block->size & BLOCK_FLAGS_MASK);
+}
+
+static inline bool block_is_free(struct tlsf_block *block)
+{
+    return block->size & BLOCK_FREE;
+}
+
+static inline void block_mark_free(struct tlsf_block *block)
+{
+    block->size |= BLOCK_FREE;
+}
+
+static inline void block_mark_used(struct tlsf_block *block)
+{
+    block->size &= ~BLOCK_FREE;
+}
+
+static inline void *block_to_ptr(struct tlsf_block *block)
+{
+    return (char *) block + BLOCK_HEADER_SIZE;
+}
+
+static inline struct tlsf_block *block_from_ptr(void *ptr)
+{
+    return (struct tlsf_block *) ((char *) ptr - BLOCK_HEADER_SIZE);
+}
+
+static inline struct tlsf_block *block_next(struct tlsf_block *block)
+{
+    return (struct tlsf_block *) ((char *) block_to_ptr(block) +
+                                  block_size(block));
+}
+
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        *fl = tlsf_fls(size);
+        *sl = (size >> (*fl - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl -= FL_INDEX_SHIFT - 1;
+    }
+}
+
+/**
+ * Same as mapping_insert() but rounds up to the next size class, so that any
+ * block found there is large enough.
+ */
+static void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK_SIZE)
+        size += (1 << (tlsf_fls(size) - SL_INDEX_COUNT_LOG2)) - 1;
+
+    mapping_insert(size, fl, sl);
+}
+
+static struct tlsf_block *search_suitable_block(struct tlsf *tlsf,
+                                                int *fl, int *sl)
+{
+    uint32_t sl_map;
+    uint32_t fl_map;
+
+    if (*fl >= FL_INDEX_COUNT)
+        return NULL;
+
+    sl_map = tlsf->sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        fl_map = tlsf->fl_bitmap & (~0u << (*fl + 1));
+        if (!fl_map)
+            return NULL;
+
+        *fl = tlsf_ffs(fl_map);
+        sl_map = tlsf->sl_bitmap[*fl];
+    }
+
+    *sl = tlsf_ffs(sl_map);
+    return tlsf->blocks[*fl][*sl];
+}
+
+static void remove_free_block(struct tlsf *tlsf, struct tlsf_block *block,
+                              int fl, int sl)
+{
+    struct tlsf_block *prev = block->prev_free;
+    struct tlsf_block *next = block->next_free;
+
+    next->prev_free = prev;
+    prev->next_free = next;
+
+    if (tlsf->blocks[fl][sl] != block)
+        return;
+
+    tlsf->blocks[fl][sl] = next;
+    if (next != &tlsf->null_block)
+        return;
+
+    tlsf->sl_bitmap[fl] &= ~(1 << sl);
+    if (!tlsf->sl_bitmap[fl])
+        tlsf->fl_bitmap &= ~(1 << fl);
+}
+
+static void insert_free_block(struct tlsf *tlsf, struct tlsf_block *block,
+                              int fl, int sl)
+{
+    struct tlsf_block *current = tlsf->blocks[fl][sl];
+
+    block->next_free = current;
+    block->prev_free = &tlsf->null_block;
+    current->prev_free = block;
+
+    tlsf->blocks[fl][sl] = block;
+    tlsf->fl_bitmap |= 1 << fl;
+    tlsf->sl_bitmap[fl] |= 1 << sl;
+}
+
+static void block_remove(struct tlsf *tlsf, struct tlsf_block *block)
+{
+    int fl, sl;
+
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free_block(tlsf, block, fl, sl);
+}
+
+static void block_insert(struct tlsf *tlsf, struct tlsf_block *block)
+{
+    int fl, sl;
+
+    mapping_insert(block_size(block), &fl, &sl);
+    insert_free_block(tlsf, block, fl, sl);
+}
+
+static bool block_can_split(struct tlsf_block *block, size_t size)
+{
+    return block_size(block) >= size + sizeof(struct tlsf_block);
+}
+
+/**
+ * Cut a block after size bytes of payload, returns the remaining block
+ */
+static struct tlsf_block *block_split(struct tlsf_block *block, size_t size)
+{
+    struct tlsf_block *remaining;
+
+    remaining = (struct tlsf_block *) ((char *) block_to_ptr(block) + size);
+    remaining->size = block_size(block) - size - BLOCK_HEADER_SIZE;
+    remaining->prev_phys = block;
+    block_next(remaining)->prev_phys = remaining;
+
+    block_set_size(block, size);
+
+    return remaining;
+}
+
+/**
+ * Merge a block with the one following it in memory
+ */
+static void block_absorb(struct tlsf_block *block, struct tlsf_block *next)
+{
+    block_set_size(block, block_size(block) + block_size(next) +
+                          BLOCK_HEADER_SIZE);
+    block_next(block)->prev_phys = block;
+}
+
+static struct tlsf_block *block_merge_prev(struct tlsf *tlsf,
+                                           struct tlsf_block *block)
+{
+    struct tlsf_block *prev = block->prev_phys;
+
+    if (!prev || !block_is_free(prev))
+        return block;
+
+    block_remove(tlsf, prev);
+    block_absorb(prev, block);
+
+    return prev;
+}
+
+static void block_merge_next(struct tlsf *tlsf, struct tlsf_block *block)
+{
+    struct tlsf_block *next = block_next(block);
+
+    if (!block_is_free(next))
+        return;
+
+    block_remove(tlsf, next);
+    block_absorb(block, next);
+}
+
+/**
+ * Give back the end of a free block not in any list
+ */
+static void block_trim_free(struct tlsf *tlsf, struct tlsf_block *block,
+                            size_t size)
+{
+    struct tlsf_block *remaining;
+
+    if (!block_can_split(block, size))
+        return;
+
+    remaining = block_split(block, size);
+    block_mark_free(remaining);
+    block_insert(tlsf, remaining);
+}
+
+/**
+ * Give back the end of a used block
+ */
+static void block_trim_used(struct tlsf *tlsf, struct tlsf_block *block,
+                            size_t size)
+{
+    struct tlsf_block *remaining;
+
+    if (!block_can_split(block, size))
+        return;
+
+    remaining = block_split(block, size);
+    block_mark_free(remaining);
+    block_merge_next(tlsf, remaining);
+    block_insert(tlsf, remaining);
+}
+
+static size_t adjust_request_size(size_t size)
+{
+    if (!size || size > BLOCK_SIZE_MAX)
+        return 0;
+
+    size = align_up(size, TLSF_ALIGN);
+    return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+}
+
+/**
+ * Find a free block of at least size bytes and take it out of its list
+ */
+static struct tlsf_block *block_locate_free(struct tlsf *tlsf, size_t size)
+{
+    struct tlsf_block *block;
+    int fl, sl;
+
+    if (!size)
+        return NULL;
+
+    mapping_search(size, &fl, &sl);
+
+    block = search_suitable_block(tlsf, &fl, &sl);
+    if (!block || block == &tlsf->null_block)
+        return NULL;
+
+    remove_free_block(tlsf, block, fl, sl);
+    return block;
+}
+
+static void tlsf_account_used(struct tlsf *tlsf, size_t added,
+                              size_t removed)
+{
+    tlsf->used = tlsf->used + added - removed;
+    if (tlsf->used > tlsf->peak)
+        tlsf->peak = tlsf->used;
+}
+
+static void *block_prepare_used(struct tlsf *tlsf, struct tlsf_block *block,
+                                size_t size)
+{
+    block_trim_free(tlsf, block, size);
+    block_mark_used(block);
+    tlsf_account_used(tlsf, block_size(block) + BLOCK_HEADER_SIZE, 0);
+    return block_to_ptr(block);
+}
+
+struct tlsf *tlsf_create(void *mem, size_t size)
+{
+    struct tlsf *tlsf;
+    struct tlsf_block *block;
+    uintptr_t start;
+    uintptr_t end;
+
+    RET_IF_FAIL(mem, NULL);
+
+    start = align_up((uintptr_t) mem, TLSF_ALIGN);
+    end = align_down((uintptr_t) mem + size, TLSF_ALIGN);
+
+    tlsf = (struct tlsf *) start;
+    start = align_up(start + sizeof(*tlsf), TLSF_ALIGN);
+
+    /* the pool needs one free block and the end sentinel */
+    if (end < start + 2 * BLOCK_HEADER_SIZE + BLOCK_SIZE_MIN)
+        return NULL;
+
+    memset(tlsf, 0, sizeof(*tlsf));
+    tlsf->null_block.next_free = &tlsf->null_block;
+    tlsf->null_block.prev_free = &tlsf->null_block;
+
+    for (int i = 0; i < FL_INDEX_COUNT; i++) {
+        for (int j = 0; j < SL_INDEX_COUNT; j++)
+            tlsf->blocks[i][j] = &tlsf->null_block;
+    }
+
+    /* BLOCK_SIZE_MAX itself would map one past the last first level index */
+    size = end - start - 2 * BLOCK_HEADER_SIZE;
+    if (size >= BLOCK_SIZE_MAX)
+        size = BLOCK_SIZE_MAX - TLSF_ALIGN;
+
+    block = (struct tlsf_block *) start;
+    block->prev_phys = NULL;
+    block->size = size;
+    block_mark_free(block);
+    block_insert(tlsf, block);
+
+    tlsf->total = size + BLOCK_HEADER_SIZE;
+
+    /* zero-sized used block, stops the merges at the end of the pool */
+    block = block_next(block);
+    block->prev_phys = (struct tlsf_block *) start;
+    block->size = 0;
+
+    return tlsf;
+}
+
+void *tlsf_malloc(struct tlsf *tlsf, size_t size)
+{
+    struct tlsf_block *block;
+
+    size = adjust_request_size(size);
+
+    block = block_locate_free(tlsf, size);
+    if (!block)
+        return NULL;
+
+    return block_prepare_used(tlsf, block, size);
+}
+
+void *tlsf_memalign(struct tlsf *tlsf, size_t alignment, size_t size)
+{
+    struct tlsf_block *block;
+    uintptr_t ptr;
+    uintptr_t aligned;
+    size_t gap;
+
+    RET_IF_FAIL(!(alignment & (alignment - 1)), NULL);
+
+    if (alignment <= TLSF_ALIGN)
+        return tlsf_malloc(tlsf, size);
+
+    size = adjust_request_size(size);
+    if (!size)
+        return NULL;
+
+    /*
+     * Leave room for a leading gap large enough to be a free block on its
+     * own, since blocks can't be smaller than that.
+     */
+    block = block_locate_free(tlsf, size + alignment +
+                                    sizeof(struct tlsf_block));
+    if (!block)
+        return NULL;
+
+    ptr = (uintptr_t) block_to_ptr(block);
+    aligned = align_up(ptr, alignment);
+    gap = aligned - ptr;
+
+    if (gap && gap < sizeof(struct tlsf_block)) {
+        aligned = align_up(ptr + sizeof(struct tlsf_block), alignment);
+        gap = aligned - ptr;
+    }
+
+    if (gap) {
+        struct tlsf_block *leading = block;
+
+        block = block_split(leading, gap - BLOCK_HEADER_SIZE);
+        block_mark_free(block);
+        block_insert(tlsf, leading);
+    }
+
+    return block_prepare_used(tlsf, block, size);
+}
+
+void tlsf_free(struct tlsf *tlsf, void *ptr)
+{
+    struct tlsf_block *block;
+
+    if (!ptr)
+        return;
+
+    block = block_from_ptr(ptr);
+    RET_IF_FAIL(!block_is_free(block),);
+
+    tlsf_account_used(tlsf, 0, block_size(block) + BLOCK_HEADER_SIZE);
+
+    block_mark_free(block);
+    block = block_merge_prev(tlsf, block);
+    block_merge_next(tlsf, block);
+    block_insert(tlsf, block);
+}
+
+void *tlsf_realloc(struct tlsf *tlsf, void *ptr, size_t size)
+{
+    struct tlsf_block *block;
+    struct tlsf_block *next;
+    size_t current_size;
+    size_t adjusted;
+    void *new_ptr;
+
+    if (!ptr)
+        return tlsf_malloc(tlsf, size);
+
+    if (!size) {
+        tlsf_free(tlsf, ptr);
+        return NULL;
+    }
+
+    adjusted = adjust_request_size(size);
+    if (!adjusted)
+        return NULL;
+
+    block = block_from_ptr(ptr);
+    next = block_next(block);
+    current_size = block_size(block);
+
+    /* grow in place when the next block is free and large enough */
+    if (adjusted > current_size &&
+        (!block_is_free(next) ||
+         adjusted > current_size + block_size(next) + BLOCK_HEADER_SIZE)) {
+        new_ptr = tlsf_malloc(tlsf, size);
+        if (!new_ptr)
+            return NULL;
+
+        memcpy(new_ptr, ptr, current_size < size ? current_size : size);
+        tlsf_free(tlsf, ptr);
+        return new_ptr;
+    }
+
+    if (adjusted > current_size)
+        block_merge_next(tlsf, block);
+
+    block_trim_used(tlsf, block, adjusted);
+    tlsf_account_used(tlsf, block_size(block), current_size);
+
+    return ptr;
+}
+
+size_t tlsf_block_size(void *ptr)
+{
+    RET_IF_FAIL(ptr, 0);
+    return block_size(block_from_ptr(ptr));
+}
+
+void tlsf_get_stats(struct tlsf *tlsf, struct tlsf_stats *stats)
+{
+    struct tlsf_block *block;
+
+    RET_IF_FAIL(tlsf,);
+    RET_IF_FAIL(stats,);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->total = tlsf->total;
+    stats->used = tlsf->used;
+    stats->peak = tlsf->peak;
+
+    for (int i = 0; i < FL_INDEX_COUNT; i++) {
+        if (!(tlsf->fl_bitmap & (1 << i)))
+            continue;
+
+        for (int j = 0; j < SL_INDEX_COUNT; j++) {
+            for (block = tlsf->blocks[i][j]; block != &tlsf->null_block;
+                 block = block->next_free) {
+                stats->free_blocks++;
+                if (block_size(block) > stats->largest_free)
+                    stats->largest_free = block_size(block);
+            }
+        }
+    }
+}
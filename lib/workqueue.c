@@ -9,101 +9,885 @@
 #include <phabos/utils.h>
 #include <phabos/scheduler.h>
 #include <phabos/assert.h>
+#include <phabos/ktime.h>
+#include <phabos/shell.h>
+#include <phabos/slab.h>
+#include <asm/irq.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
-void workqueue_thread(void *data)
+#define WORK_PENDING        (1 << 0)
+#define WORK_AUTOFREE       (1 << 1)
+#define WORK_DELAYED        (1 << 2)
+
+#define WORKER_NOTIFY_WAKEUP    (1 << 0)
+
+#ifdef CONFIG_STATIC_KERNEL
+/*
+ * Idle workers never time out: a worker slot cannot be reused before the
+ * task that owned it has been switched out for good.
+ */
+#define WORKER_IDLE_TIMEOUT     0
+#else
+#define WORKER_IDLE_TIMEOUT     5000000 /* usec */
+#endif
+
+#define SYSTEM_WQ_MAX_ACTIVE    4
+
+struct worker {
+    struct task *task;
+    struct worker_pool *pool;
+    struct work *current_work;
+    bool idle;
+    bool sleeping;
+
+    struct list_head list;
+    struct list_head idle_list;
+
+#ifdef CONFIG_STATIC_KERNEL
+    struct task task_storage;
+    uint8_t stack[TASK_DEFAULT_STACK_SIZE];
+#endif
+};
+
+/**
+ * workers: all the workers of the pool
+ * idle_workers: workers waiting for work, most recently used first
+ * ready_list: workqueues with works ready to run and below max_active
+ * nr_running: workers processing works and not blocked
+ * priority: priority of the worker tasks
+ * static_workers: storage of the workers, a slot is in use if its pool is set
+ */
+struct worker_pool {
+    struct spinlock lock;
+    unsigned priority;
+    struct list_head workers;
+    struct list_head idle_workers;
+    struct list_head ready_list;
+    unsigned nr_workers;
+    unsigned nr_idle;
+    unsigned nr_running;
+
+#ifdef CONFIG_STATIC_KERNEL
+    struct worker static_workers[CONFIG_STATIC_WORKERS];
+#endif
+};
+
+#define WORKER_POOL_INIT(x, prio) {                     \
+    .lock = SPINLOCK_INIT((x).lock),                    \
+    .priority = (prio),                                 \
+    .workers = LIST_INIT((x).workers),                  \
+    .idle_workers = LIST_INIT((x).idle_workers),        \
+    .ready_list = LIST_INIT((x).ready_list),            \
+}
+
+static struct worker_pool system_pool =
+    WORKER_POOL_INIT(system_pool, TASK_PRIORITY_NORMAL);
+static struct worker_pool highpri_pool =
+    WORKER_POOL_INIT(highpri_pool, TASK_PRIORITY_HIGH);
+
+#ifndef CONFIG_STATIC_KERNEL
+/* works allocated by workqueue_schedule() */
+static struct kmem_cache delayed_work_cache =
+    KMEM_CACHE_INIT(delayed_work_cache, "delayed_work",
+                    sizeof(struct delayed_work), NULL);
+
+static void work_autofree(struct work *work)
 {
-    struct workqueue *wq = data;
-    struct work *work;
+    kmem_cache_free(&delayed_work_cache, work);
+}
+#else
+static inline void work_autofree(struct work *work) {}
+#endif
 
-    RET_IF_FAIL(data,);
+static struct workqueue system_wq;
+static struct workqueue system_highpri_wq;
+static struct mutex system_wq_mutex = MUTEX_INIT(system_wq_mutex);
 
-    while (1) {
-        semaphore_lock(&wq->semaphore);
+#ifdef CONFIG_WORKQUEUE_STATS
+static struct spinlock wq_stats_lock = SPINLOCK_INIT(wq_stats_lock);
+static struct list_head wq_stats_list = LIST_INIT(wq_stats_list);
 
-        list_foreach_safe(&wq->list, iter) {
-            work = list_entry(iter, struct work, list);
-            if (!work->is_schedulable)
-                continue;
+static unsigned wq_stats_bucket(uint32_t cycles)
+{
+    ktime_t ns = ktime_cycles_to_ns(cycles);
+    unsigned bucket = 0;
 
-            spinlock_lock(&wq->lock);
-            list_del(&work->list);
-            spinlock_unlock(&wq->lock);
+    while (ns > 1 && bucket < WQ_STATS_NR_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void wq_stats_ready(struct workqueue *wq, struct work *work)
+{
+    struct workqueue_stats *stats = &wq->stats;
+
+    work->ready_cycles = ktime_get_cycles();
+
+    stats->queued++;
+    if (++stats->depth > stats->max_depth)
+        stats->max_depth = stats->depth;
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void wq_stats_cancel(struct workqueue *wq, struct work *work)
+{
+    if (!(work->flags & WORK_DELAYED))
+        wq->stats.depth--;
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void wq_stats_start(struct workqueue *wq, struct work *work)
+{
+    uint32_t latency = ktime_get_cycles() - work->ready_cycles;
+
+    wq->stats.depth--;
+    wq->stats.latency[wq_stats_bucket(latency)]++;
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void wq_stats_done(struct workqueue *wq, work_entry_t callback,
+                          uint32_t start_cycles)
+{
+    struct workqueue_stats *stats = &wq->stats;
+    uint32_t exec = ktime_get_cycles() - start_cycles;
+
+    stats->exec[wq_stats_bucket(exec)]++;
+
+    for (int i = 0; i < WQ_STATS_NR_CALLBACKS; i++) {
+        if (!stats->callbacks[i].callback)
+            stats->callbacks[i].callback = callback;
+
+        if (stats->callbacks[i].callback == callback) {
+            stats->callbacks[i].count++;
+            return;
+        }
+    }
+
+    stats->other_callbacks++;
+}
+
+static void wq_stats_register(struct workqueue *wq)
+{
+    spinlock_lock(&wq_stats_lock);
+    list_add(&wq_stats_list, &wq->stats_list);
+    spinlock_unlock(&wq_stats_lock);
+}
+
+static void wq_stats_unregister(struct workqueue *wq)
+{
+    spinlock_lock(&wq_stats_lock);
+    list_del(&wq->stats_list);
+    spinlock_unlock(&wq_stats_lock);
+}
+#else
+static inline void wq_stats_ready(struct workqueue *wq, struct work *work) {}
+static inline void wq_stats_cancel(struct workqueue *wq, struct work *work) {}
+static inline void wq_stats_start(struct workqueue *wq, struct work *work) {}
+static inline void wq_stats_done(struct workqueue *wq, work_entry_t callback,
+                                 uint32_t start_cycles) {}
+static inline void wq_stats_register(struct workqueue *wq) {}
+static inline void wq_stats_unregister(struct workqueue *wq) {}
+#endif
+
+static void workqueue_work_done(struct workqueue *wq)
+{
+    if (atomic_dec(&wq->work_count) == 0)
+        complete_all(&wq->empty);
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void workqueue_wake_flushers(struct workqueue *wq)
+{
+    list_foreach_safe(&wq->flush_wait_list, iter)
+        task_remove_from_wait_list(list_entry(iter, struct task, list));
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static bool pool_has_work(struct worker_pool *pool)
+{
+    return !list_is_empty(&pool->ready_list);
+}
+
+/**
+ * Wake up an idle worker if there is work and nobody is running it
+ *
+ * Must be called with pool->lock held
+ */
+static void pool_wake_worker(struct worker_pool *pool)
+{
+    struct worker *worker;
+
+    if (pool->nr_running || !pool_has_work(pool))
+        return;
+
+    if (list_is_empty(&pool->idle_workers))
+        return;
+
+    worker = list_first_entry(&pool->idle_workers, struct worker, idle_list);
+    task_notify(worker->task, WORKER_NOTIFY_WAKEUP, TASK_NOTIFY_SET_BITS);
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static bool workqueue_has_ready_work(struct workqueue *wq)
+{
+    for (int i = 0; i < NR_WORK_BANDS; i++) {
+        if (!list_is_empty(&wq->list[i]))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Put the workqueue on the pool ready list if it can hand out a work
+ *
+ * Must be called with pool->lock held
+ */
+static void workqueue_make_ready(struct workqueue *wq)
+{
+    if (!workqueue_has_ready_work(wq) || wq->nr_active >= wq->max_active)
+        return;
+
+    if (list_is_empty(&wq->pool_list))
+        list_add(&wq->pool->ready_list, &wq->pool_list);
+}
+
+/**
+ * Take the next work to run from the pool
+ *
+ * Workqueues are served round-robin so that a busy queue doesn't starve the
+ * others sharing the pool. Within a workqueue, the most urgent band goes
+ * first.
+ *
+ * Must be called with pool->lock held
+ */
+static struct work *pool_dequeue_work(struct worker_pool *pool)
+{
+    struct workqueue *wq;
+    struct work *work = NULL;
+
+    wq = list_first_entry(&pool->ready_list, struct workqueue, pool_list);
+
+    for (int i = 0; i < NR_WORK_BANDS; i++) {
+        if (!list_is_empty(&wq->list[i])) {
+            work = list_first_entry(&wq->list[i], struct work, list);
+            break;
+        }
+    }
+
+    list_del(&work->list);
+    list_del(&wq->pool_list);
+    wq->nr_active++;
+    workqueue_make_ready(wq);
+
+    wq_stats_start(wq, work);
+
+    return work;
+}
 
-            if (work->entry_point)
-                work->entry_point(work->data);
+static bool work_is_running(struct worker_pool *pool, struct work *work)
+{
+    list_foreach(&pool->workers, iter) {
+        struct worker *worker = list_entry(iter, struct worker, list);
+        if (worker->current_work == work)
+            return true;
+    }
+
+    return false;
+}
 
-            watchdog_delete(&work->watchdog);
-            free(work);
+/**
+ * Must be called with pool->lock held, drops it while the work runs
+ */
+static void worker_process_work(struct worker *worker, struct work *work)
+{
+    struct worker_pool *pool = worker->pool;
+    struct workqueue *wq = work->wq;
+    work_entry_t entry_point;
+    void *work_data;
+    uint32_t start_cycles;
+    bool autofree;
+
+    /*
+     * The work can be queued again or freed as soon as its callback
+     * starts, so don't touch it afterward.
+     */
+    entry_point = work->entry_point;
+    work_data = work->data;
+    autofree = work->flags & WORK_AUTOFREE;
+    work->flags &= ~WORK_PENDING;
+    worker->current_work = work;
+
+    spinlock_unlock(&pool->lock);
+
+    start_cycles = ktime_get_cycles();
+
+    if (entry_point)
+        entry_point(work_data);
+
+    if (autofree)
+        work_autofree(work);
+
+    spinlock_lock(&pool->lock);
+
+    wq_stats_done(wq, entry_point, start_cycles);
+
+    worker->current_work = NULL;
+    wq->nr_active--;
+    workqueue_make_ready(wq);
+    workqueue_wake_flushers(wq);
+    workqueue_work_done(wq);
+}
+
+static struct worker *worker_create(struct worker_pool *pool);
+static void worker_thread(void *data);
+
+#ifdef CONFIG_STATIC_KERNEL
+/**
+ * Returns NULL once all the workers of the pool are in use
+ */
+static struct worker *worker_alloc(struct worker_pool *pool)
+{
+    struct worker *worker = NULL;
+
+    spinlock_lock(&pool->lock);
+
+    for (int i = 0; i < CONFIG_STATIC_WORKERS; i++) {
+        if (!pool->static_workers[i].pool) {
+            worker = &pool->static_workers[i];
+            worker->pool = pool;
             break;
         }
+    }
+
+    spinlock_unlock(&pool->lock);
+
+    return worker;
+}
+
+static void worker_free(struct worker *worker)
+{
+    worker->pool = NULL;
+}
+
+static struct task *worker_task_create(struct worker *worker)
+{
+    return task_init(&worker->task_storage, worker_thread, worker,
+                     worker->stack, sizeof(worker->stack));
+}
+#else
+static struct worker *worker_alloc(struct worker_pool *pool)
+{
+    struct worker *worker;
+
+    worker = zalloc(sizeof(*worker));
+    RET_IF_FAIL(worker, NULL);
+
+    worker->pool = pool;
+    return worker;
+}
+
+static void worker_free(struct worker *worker)
+{
+    free(worker);
+}
+
+static struct task *worker_task_create(struct worker *worker)
+{
+    return task_create(worker_thread, worker, 0);
+}
+#endif
+
+
+static void worker_thread(void *data)
+{
+    struct worker *worker = data;
+    struct worker_pool *pool = worker->pool;
+    bool need_worker;
+    uint32_t notified;
+
+    while (1) {
+        notified = task_notify_wait(WORKER_NOTIFY_WAKEUP, WORKER_IDLE_TIMEOUT);
+
+        spinlock_lock(&pool->lock);
+
+        if (!pool_has_work(pool)) {
+            /*
+             * Keep two idle workers around: one to take the next work and a
+             * standby one, so that sporadic work doesn't pay for creating a
+             * worker on every wake up and tearing it down once idle again.
+             */
+            if (!notified && pool->nr_idle > 2)
+                break;
 
-        if (atomic_dec(&wq->work_count) <= 0)
-            semaphore_unlock(&wq->empty_semaphore);
+            spinlock_unlock(&pool->lock);
+            continue;
+        }
+
+        list_del(&worker->idle_list);
+        pool->nr_idle--;
+        pool->nr_running++;
+        worker->idle = false;
+
+        need_worker = !pool->nr_idle;
+
+        spinlock_unlock(&pool->lock);
+
+        /*
+         * Make sure there is a worker ready to take over if this one blocks,
+         * task creation cannot be done from the scheduler hook.
+         */
+        if (need_worker)
+            worker_create(pool);
+
+        spinlock_lock(&pool->lock);
+
+        /*
+         * Another worker running means that one which was blocked is back,
+         * leave the remaining work to it.
+         */
+        while (pool_has_work(pool)) {
+            worker_process_work(worker, pool_dequeue_work(pool));
+            if (pool->nr_running > 1)
+                break;
+        }
+
+        worker->idle = true;
+        pool->nr_running--;
+        pool->nr_idle++;
+        list_add(pool->idle_workers.next, &worker->idle_list);
+
+        pool_wake_worker(pool);
+        spinlock_unlock(&pool->lock);
     }
+
+    list_del(&worker->list);
+    list_del(&worker->idle_list);
+    pool->nr_workers--;
+    pool->nr_idle--;
+
+    worker->task->worker = NULL;
+    spinlock_unlock(&pool->lock);
+
+    worker_free(worker);
+    task_exit();
 }
 
-void workqueue_delay_timeout(struct watchdog *wd)
+static struct worker *worker_create(struct worker_pool *pool)
 {
-    struct work *work = containerof(wd, struct work, watchdog);
+    struct worker *worker;
+
+    worker = worker_alloc(pool);
+    if (!worker)
+        return NULL;
+
+    worker->idle = true;
+    list_init(&worker->list);
+    list_init(&worker->idle_list);
+
+    /* the worker must be set up before it gets a chance to run */
+    worker->task = worker_task_create(worker);
+    if (!worker->task) {
+        worker_free(worker);
+        return NULL;
+    }
+
+    worker->task->worker = worker;
+    task_set_priority(worker->task, pool->priority);
 
-    RET_IF_FAIL(wd,);
-    RET_IF_FAIL(work->wq,);
+    spinlock_lock(&pool->lock);
+    list_add(&pool->workers, &worker->list);
+    list_add(pool->idle_workers.next, &worker->idle_list);
+    pool->nr_workers++;
+    pool->nr_idle++;
+    spinlock_unlock(&pool->lock);
 
-    work->is_schedulable = true;
-    semaphore_unlock(&work->wq->semaphore);
+    task_start(worker->task);
+
+    return worker;
 }
 
-struct workqueue *workqueue_create(const char *name)
+void workqueue_worker_sleeping(struct task *task)
+{
+    struct worker *worker = task->worker;
+    struct worker_pool *pool = worker->pool;
+
+    if (worker->idle || worker->sleeping)
+        return;
+
+    worker->sleeping = true;
+    pool->nr_running--;
+    pool_wake_worker(pool);
+}
+
+void workqueue_worker_waking_up(struct task *task)
+{
+    struct worker *worker = task->worker;
+
+    if (worker->idle || !worker->sleeping)
+        return;
+
+    worker->sleeping = false;
+    worker->pool->nr_running++;
+}
+
+/**
+ * Must be called with pool->lock held
+ */
+static void workqueue_insert(struct workqueue *wq, struct work *work)
+{
+    list_add(&wq->list[work->band], &work->list);
+    wq_stats_ready(wq, work);
+    workqueue_make_ready(wq);
+    pool_wake_worker(wq->pool);
+}
+
+static void workqueue_delay_timeout(struct watchdog *wd)
+{
+    struct delayed_work *dwork = containerof(wd, struct delayed_work,
+                                             watchdog);
+    struct workqueue *wq = dwork->work.wq;
+
+    RET_IF_FAIL(wq,);
+
+    spinlock_lock(&wq->pool->lock);
+    list_del(&dwork->work.list);
+    dwork->work.flags &= ~WORK_DELAYED;
+    workqueue_insert(wq, &dwork->work);
+    spinlock_unlock(&wq->pool->lock);
+}
+
+void work_init(struct work *work, work_entry_t callback, void *data)
+{
+    RET_IF_FAIL(work,);
+
+    memset(work, 0, sizeof(*work));
+    work->entry_point = callback;
+    work->data = data;
+    work->band = WORK_BAND_NORMAL;
+    list_init(&work->list);
+}
+
+void work_set_band(struct work *work, enum work_band band)
+{
+    RET_IF_FAIL(work,);
+    RET_IF_FAIL(band < NR_WORK_BANDS,);
+    RET_IF_FAIL(!(work->flags & WORK_PENDING),);
+
+    work->band = band;
+}
+
+void delayed_work_init(struct delayed_work *dwork, work_entry_t callback,
+                       void *data)
+{
+    RET_IF_FAIL(dwork,);
+
+    work_init(&dwork->work, callback, data);
+
+    watchdog_init(&dwork->watchdog);
+    dwork->watchdog.timeout = workqueue_delay_timeout;
+}
+
+/**
+ * Mark a work as pending on a workqueue
+ *
+ * Returns false if the work was already pending
+ */
+static bool workqueue_claim_work(struct workqueue *wq, struct work *work)
+{
+    spinlock_lock(&wq->pool->lock);
+
+    if (work->flags & WORK_PENDING) {
+        spinlock_unlock(&wq->pool->lock);
+        return false;
+    }
+
+    work->flags |= WORK_PENDING;
+    work->wq = wq;
+
+    spinlock_unlock(&wq->pool->lock);
+
+    if (atomic_inc(&wq->work_count) == 1)
+        completion_reinit(&wq->empty);
+
+    return true;
+}
+
+bool workqueue_queue_work(struct workqueue *wq, struct work *work)
+{
+    RET_IF_FAIL(wq, false);
+    RET_IF_FAIL(work, false);
+    RET_IF_FAIL(work->entry_point, false);
+
+    if (!workqueue_claim_work(wq, work))
+        return false;
+
+    spinlock_lock(&wq->pool->lock);
+    workqueue_insert(wq, work);
+    spinlock_unlock(&wq->pool->lock);
+
+    return true;
+}
+
+bool workqueue_queue_delayed_work(struct workqueue *wq,
+                                  struct delayed_work *dwork,
+                                  unsigned long delay)
+{
+    RET_IF_FAIL(wq, false);
+    RET_IF_FAIL(dwork, false);
+
+    if (!delay)
+        return workqueue_queue_work(wq, &dwork->work);
+
+    RET_IF_FAIL(dwork->work.entry_point, false);
+
+    if (!workqueue_claim_work(wq, &dwork->work))
+        return false;
+
+    spinlock_lock(&wq->pool->lock);
+    list_add(&wq->delayed_list, &dwork->work.list);
+    dwork->work.flags |= WORK_DELAYED;
+    watchdog_start(&dwork->watchdog, delay);
+    spinlock_unlock(&wq->pool->lock);
+
+    return true;
+}
+
+bool work_is_pending(struct work *work)
+{
+    RET_IF_FAIL(work, false);
+    return work->flags & WORK_PENDING;
+}
+
+bool work_cancel(struct work *work)
 {
     struct workqueue *wq;
 
-    RET_IF_FAIL(name, NULL);
+    RET_IF_FAIL(work, false);
 
-    wq = zalloc(sizeof(*wq));
-    RET_IF_FAIL(wq, NULL);
+    wq = work->wq;
+    if (!wq)
+        return false;
 
-    wq->name = name;
-    wq->task = task_run(workqueue_thread, wq, 0);
-    if (!wq->task)
-        goto task_run_error;
+    spinlock_lock(&wq->pool->lock);
+
+    if (!(work->flags & WORK_PENDING)) {
+        spinlock_unlock(&wq->pool->lock);
+        return false;
+    }
 
-    semaphore_init(&wq->semaphore, 0);
-    semaphore_init(&wq->empty_semaphore, 1);
-    list_init(&wq->list);
+    if (!list_is_empty(&work->list))
+        list_del(&work->list);
+    wq_stats_cancel(wq, work);
+    work->flags &= ~(WORK_PENDING | WORK_DELAYED);
+
+    if (!workqueue_has_ready_work(wq))
+        list_del(&wq->pool_list);
+
+    workqueue_wake_flushers(wq);
+
+    spinlock_unlock(&wq->pool->lock);
+
+    workqueue_work_done(wq);
+    return true;
+}
+
+bool delayed_work_cancel(struct delayed_work *dwork)
+{
+    RET_IF_FAIL(dwork, false);
+
+    watchdog_cancel(&dwork->watchdog);
+    return work_cancel(&dwork->work);
+}
+
+void work_flush(struct work *work)
+{
+    struct workqueue *wq;
+
+    RET_IF_FAIL(work,);
+
+    wq = work->wq;
+    if (!wq)
+        return;
+
+    irq_disable();
+
+    while ((work->flags & WORK_PENDING) || work_is_running(wq->pool, work))
+        task_wait(&wq->flush_wait_list);
+
+    irq_enable();
+}
+
+int workqueue_init(struct workqueue *wq, const char *name, unsigned flags,
+                   unsigned max_active)
+{
+    struct worker_pool *pool;
+
+    RET_IF_FAIL(wq, -EINVAL);
+    RET_IF_FAIL(name, -EINVAL);
+    RET_IF_FAIL(max_active, -EINVAL);
+
+    pool = flags & WQ_HIGHPRI ? &highpri_pool : &system_pool;
+
+    if (!pool->nr_workers && !worker_create(pool))
+        return -ENOMEM;
+
+    memset(wq, 0, sizeof(*wq));
+    wq->name = name;
+    wq->pool = pool;
+    wq->max_active = max_active;
+
+    completion_init(&wq->empty);
+    complete_all(&wq->empty);
+    for (int i = 0; i < NR_WORK_BANDS; i++)
+        list_init(&wq->list[i]);
+    list_init(&wq->delayed_list);
+    list_init(&wq->pool_list);
+    list_init(&wq->flush_wait_list);
     atomic_init(&wq->work_count, 0);
-    spinlock_init(&wq->lock);
+
+    wq_stats_register(wq);
+
+    return 0;
+}
+
+#ifndef CONFIG_STATIC_KERNEL
+struct workqueue *workqueue_alloc(const char *name, unsigned flags,
+                                  unsigned max_active)
+{
+    struct workqueue *wq;
+
+    wq = malloc(sizeof(*wq));
+    RET_IF_FAIL(wq, NULL);
+
+    if (workqueue_init(wq, name, flags, max_active)) {
+        free(wq);
+        return NULL;
+    }
 
     return wq;
+}
 
-task_run_error:
-    free(wq);
-    return NULL;
+struct workqueue *workqueue_create(const char *name)
+{
+    return workqueue_alloc(name, 0, 1);
 }
+#endif
 
-void workqueue_destroy(struct workqueue *wq)
+static struct workqueue *system_workqueue_get(struct workqueue *wq,
+                                              const char *name,
+                                              unsigned flags)
+{
+    mutex_lock(&system_wq_mutex);
+
+    if (!wq->pool && workqueue_init(wq, name, flags, SYSTEM_WQ_MAX_ACTIVE))
+        wq = NULL;
+
+    mutex_unlock(&system_wq_mutex);
+
+    return wq;
+}
+
+struct workqueue *system_workqueue(void)
+{
+    return system_workqueue_get(&system_wq, "system", 0);
+}
+
+struct workqueue *system_highpri_workqueue(void)
+{
+    return system_workqueue_get(&system_highpri_wq, "system_highpri",
+                                WQ_HIGHPRI);
+}
+
+int workqueue_set_max_active(struct workqueue *wq, unsigned max_active)
+{
+    RET_IF_FAIL(wq, -EINVAL);
+    RET_IF_FAIL(max_active, -EINVAL);
+
+    spinlock_lock(&wq->pool->lock);
+    wq->max_active = max_active;
+    workqueue_make_ready(wq);
+    pool_wake_worker(wq->pool);
+    spinlock_unlock(&wq->pool->lock);
+
+    return 0;
+}
+
+void workqueue_deinit(struct workqueue *wq)
 {
     struct work *work;
 
-    if (!wq)
-        return;
+    RET_IF_FAIL(wq,);
+
+    wq_stats_unregister(wq);
 
-    RET_IF_FAIL(wq->task,);
+    spinlock_lock(&wq->pool->lock);
 
-    task_kill(wq->task);
+    list_foreach_safe(&wq->delayed_list, iter) {
+        struct delayed_work *dwork = list_entry(iter, struct delayed_work,
+                                                work.list);
 
-    list_foreach_safe(&wq->list, iter) {
-        work = list_entry(iter, struct work, list);
+        watchdog_cancel(&dwork->watchdog);
+        work = &dwork->work;
         list_del(&work->list);
-        free(work);
+        work->flags &= ~WORK_DELAYED;
+        list_add(&wq->list[work->band], &work->list);
+    }
+
+    for (int i = 0; i < NR_WORK_BANDS; i++) {
+        list_foreach_safe(&wq->list[i], iter) {
+            work = list_entry(iter, struct work, list);
+            list_del(&work->list);
+            work->flags &= ~WORK_PENDING;
+            if (work->flags & WORK_AUTOFREE)
+                work_autofree(work);
+            else
+                work->wq = NULL;
+        }
     }
 
-    // FIXME
-    // destroy will try to free the smeaphore pointer.
-    //semaphore_destroy(&wq->semaphore);
-    //semaphore_destroy(&wq->empty_semaphore);
+    list_del(&wq->pool_list);
+
+    /* the workers still reference the workqueue while running its works */
+    while (wq->nr_active)
+        task_wait(&wq->flush_wait_list);
+
+    /* the dropped works will never complete, release whoever waits on them */
+    atomic_init(&wq->work_count, 0);
+    workqueue_wake_flushers(wq);
+    complete_all(&wq->empty);
+
+    spinlock_unlock(&wq->pool->lock);
+}
+
+#ifndef CONFIG_STATIC_KERNEL
+void workqueue_destroy(struct workqueue *wq)
+{
+    if (!wq)
+        return;
+
+    workqueue_deinit(wq);
     free(wq);
 }
 
@@ -118,50 +902,117 @@ void workqueue_queue(struct workqueue *wq, work_entry_t entry, void *data)
 void workqueue_schedule(struct workqueue *wq, work_entry_t callback,
                         void *data, uint32_t delay)
 {
-    struct work *work;
+    struct delayed_work *dwork;
 
     RET_IF_FAIL(wq,);
     RET_IF_FAIL(callback,);
 
-    work = zalloc(sizeof(*work));
-    RET_IF_FAIL(work,);
-
-    work->entry_point = callback;
-    work->data = data;
-    work->is_schedulable = delay ? false : true;
-    list_init(&work->list);
-
-    watchdog_init(&work->watchdog);
-    work->watchdog.timeout = workqueue_delay_timeout;
-    work->watchdog.user_priv = work;
-    work->wq = wq;
-
-    if (atomic_inc(&wq->work_count) == 1)
-        semaphore_lock(&wq->empty_semaphore);
+    dwork = kmem_cache_alloc(&delayed_work_cache, 0);
+    RET_IF_FAIL(dwork,);
 
-    spinlock_lock(&wq->lock);
-    list_add(&wq->list, &work->list);
-    spinlock_unlock(&wq->lock);
+    delayed_work_init(dwork, callback, data);
+    dwork->work.flags = WORK_AUTOFREE;
 
-    if (delay)
-        watchdog_start(&work->watchdog, delay);
-    else
-        semaphore_unlock(&wq->semaphore);
+    workqueue_queue_delayed_work(wq, dwork, delay);
 }
+#endif
 
 bool workqueue_has_pending_work(struct workqueue *wq)
 {
     RET_IF_FAIL(wq, false);
-    return !list_is_empty(&wq->list);
+    return atomic_get(&wq->work_count) > wq->nr_active;
 }
 
 int workqueue_wait_empty(struct workqueue *wq, int timeout)
 {
     RET_IF_FAIL(wq, -EINVAL);
 
-    // TODO implement the timeout
+    if (timeout > 0)
+        return wait_for_completion_timeout(&wq->empty, timeout);
 
-    semaphore_lock(&wq->empty_semaphore);
-    semaphore_unlock(&wq->empty_semaphore);
+    wait_for_completion(&wq->empty);
     return 0;
 }
+
+#ifdef CONFIG_WORKQUEUE_STATS
+static void wq_stats_print_histogram(const char *title, const uint32_t *buckets)
+{
+    printf("  %s:\n", title);
+
+    for (int i = 0; i < WQ_STATS_NR_BUCKETS; i++) {
+        if (buckets[i])
+            printf("    >= %10lu ns: %lu\n", 1ul << i, buckets[i]);
+    }
+}
+
+/**
+ * Copy the stats of the n-th registered workqueue
+ *
+ * Returns false if there is no such workqueue.
+ */
+static bool wq_stats_snapshot(unsigned n, struct workqueue_stats *stats,
+                              const char **name, bool reset)
+{
+    struct workqueue *wq = NULL;
+
+    spinlock_lock(&wq_stats_lock);
+
+    list_foreach(&wq_stats_list, iter) {
+        if (!n--) {
+            wq = list_entry(iter, struct workqueue, stats_list);
+            break;
+        }
+    }
+
+    if (wq) {
+        spinlock_lock(&wq->pool->lock);
+
+        memcpy(stats, &wq->stats, sizeof(*stats));
+        *name = wq->name;
+
+        if (reset) {
+            unsigned depth = wq->stats.depth;
+
+            memset(&wq->stats, 0, sizeof(wq->stats));
+            wq->stats.depth = wq->stats.max_depth = depth;
+        }
+
+        spinlock_unlock(&wq->pool->lock);
+    }
+
+    spinlock_unlock(&wq_stats_lock);
+
+    return wq != NULL;
+}
+
+static int wqstat_main(int argc, char **argv)
+{
+    struct workqueue_stats stats;
+    const char *name;
+    bool reset = argc > 1 && !strcmp(argv[1], "-r");
+
+    for (unsigned i = 0; wq_stats_snapshot(i, &stats, &name, reset); i++) {
+        printf("%s: queued %lu, depth %u, max depth %u\n", name,
+               stats.queued, stats.depth, stats.max_depth);
+
+        wq_stats_print_histogram("latency", stats.latency);
+        wq_stats_print_histogram("execution", stats.exec);
+
+        printf("  callbacks:\n");
+        for (int j = 0; j < WQ_STATS_NR_CALLBACKS; j++) {
+            if (stats.callbacks[j].callback)
+                printf("    %p: %lu\n", stats.callbacks[j].callback,
+                       stats.callbacks[j].count);
+        }
+
+        if (stats.other_callbacks)
+            printf("    others: %lu\n", stats.other_callbacks);
+    }
+
+    return 0;
+}
+
+__shell_command__ struct shell_command wq_commands[] = {
+    {"wqstat", "dump workqueue statistics, -r to reset them", wqstat_main},
+};
+#endif